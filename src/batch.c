@@ -0,0 +1,211 @@
+// Editing many inputs in one editor session.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <error.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <gnulib/safe-read.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "batch.h"
+#include "ioblksize.h"
+
+
+struct areas {
+	int *fds;
+	size_t count;
+};
+
+/**
+ * @description - Starts a new, empty storage area at the end of the list.
+ * @return - its descriptor, or -1 on failure.
+ */
+static int areas_add(struct areas *a, const struct mvipe_options *opts) {
+	int fd = mvipe_storage_open(opts);
+	if (fd < 0) return -1;
+	a->fds = xreallocarray(a->fds, a->count + 1, sizeof(int));
+	a->fds[a->count++] = fd;
+	return fd;
+}
+
+/**
+ * @description - Copies everything from one fd to another.
+ * @argument from - where to read
+ * @argument at - offset to pread from, or -1 to read from the current offset
+ * @argument to - where to write
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int copy_fd(int from, off_t at, int to) {
+	char buf[IO_BUFSIZE];
+	size_t got;
+
+	while (true) {
+		if (at < 0) got = safe_read(from, buf, sizeof(buf));
+		else {
+			ssize_t n;
+			while ((n = pread(from, buf, sizeof(buf), at)) < 0 && errno == EINTR);
+			got = n < 0 ? SAFE_READ_ERROR : (size_t) n;
+			if (n > 0) at += n;
+		}
+		if (got == SAFE_READ_ERROR) return -1;
+		if (got == 0) return 0;
+		if (full_write(to, buf, got) != got) return -1;
+	}
+}
+
+/**
+ * @description - Writes an edited result back over a file, through a copy
+ *   beside it renamed over the original, so a failure part way leaves the
+ *   original as it was. Anything but a regular file is written directly.
+ * @argument from - the storage area holding the result
+ * @argument path - the file to replace
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int write_back(int from, const char *path) {
+	struct stat stat_buf;
+	if (stat(path, &stat_buf) != 0) return -1;
+	if (!S_ISREG(stat_buf.st_mode)) {
+		int out = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+		if (out < 0) return -1;
+		int failed = copy_fd(from, 0, out);
+		if (close(out) != 0) failed = -1;
+		return failed;
+	}
+
+	// The rename only works within a filesystem, so the copy goes in the same
+	// directory, hidden, like `--each` does it.
+	const char *base = strrchr(path, '/');
+	size_t dirlen = base != NULL ? (size_t) (base - path) + 1 : 0;
+	base = base != NULL ? base + 1 : path;
+	char *tmp = xmalloc(dirlen + strlen(base) + sizeof(".m-vipe-XXXXXX") + 1);
+	memcpy(tmp, path, dirlen);
+	strcpy(tmp + dirlen, ".");
+	strcat(tmp + dirlen, base);
+	strcat(tmp + dirlen, ".m-vipe-XXXXXX");
+
+	int out = mkostemp(tmp, O_CLOEXEC);
+	if (out < 0) {
+		free(tmp);
+		return -1;
+	}
+	// Keep who may read it; the owner only follows when we're allowed to.
+	if (copy_fd(from, 0, out) != 0 || fchmod(out, stat_buf.st_mode & 07777) != 0) goto fail;
+	if (fchown(out, stat_buf.st_uid, stat_buf.st_gid) != 0) errno = 0;
+	if (close(out) != 0) {
+		out = -1;
+		goto fail;
+	}
+	out = -1;
+	if (rename(tmp, path) != 0) goto fail;
+	free(tmp);
+	return 0;
+
+	fail: {
+		int saved = errno;
+		if (out >= 0) close(out);
+		unlink(tmp);
+		free(tmp);
+		errno = saved;
+		return -1;
+	}
+}
+
+/**
+ * @description - Splits stdin into a storage area per NUL terminated record.
+ *   A missing terminator on the last record is forgiven, but there's no
+ *   empty record after a final NUL.
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int split_stdin(struct areas *a, const struct mvipe_options *opts) {
+	char buf[IO_BUFSIZE];
+	size_t got;
+	int cur = -1;
+
+	while ((got = safe_read(STDIN_FILENO, buf, sizeof(buf))) != 0) {
+		if (got == SAFE_READ_ERROR) return -1;
+		for (char *at = buf, *end = buf + got; at < end;) {
+			if (cur < 0 && (cur = areas_add(a, opts)) < 0) return -1;
+			char *nul = memchr(at, '\0', (size_t) (end - at));
+			size_t len = (size_t) ((nul != NULL ? nul : end) - at);
+			if (full_write(cur, at, len) != len) return -1;
+			at += len;
+			if (nul != NULL) {
+				cur = -1;
+				at++;
+			}
+		}
+	}
+	return 0;
+}
+
+int batch_run(const struct mvipe_options *opts, const struct batch *b) {
+	struct areas a = { 0 };
+	struct rlimit files;
+	int status = 0;
+
+	// Every input holds a descriptor until it's written back; the soft
+	// limit is often far below what we're allowed.
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
+
+	if (b->nfrom == 0) {
+		if (split_stdin(&a, opts) != 0) {
+			error(0, errno, "Couldn't capture records from stdin");
+			status = 1;
+		}
+	}
+	else for (size_t l=0; l < b->nfrom && status == 0; l++) {
+		int in = open(b->from[l], O_RDONLY | O_CLOEXEC);
+		int fd = in < 0 ? -1 : areas_add(&a, opts);
+		if (fd < 0 || copy_fd(in, -1, fd) != 0) {
+			error(0, errno, "Couldn't capture '%s'", b->from[l]);
+			status = 1;
+		}
+		if (in >= 0) close(in);
+	}
+
+	if (status == 0 && a.count != 0) {
+		status = mvipe_edit_fds(opts, a.fds, a.count);
+		if (status != 0) error(0, errno, "%s", mvipe_strerror());
+	}
+
+	// Nothing is written back unless every editor finished cleanly.
+	const char *sep = b->separator;
+	size_t seplen = sep != NULL ? strlen(sep) : b->null ? 1 : 0;
+	if (sep == NULL) sep = ""; // Its terminator is the NUL for `null`.
+	for (size_t l=0; l < a.count && status == 0; l++) {
+		if (b->in_place) {
+			if (write_back(a.fds[l], b->from[l]) != 0) {
+				error(0, errno, "Couldn't write back '%s'", b->from[l]);
+				status = 1;
+			}
+			continue;
+		}
+
+		if ((l != 0 && b->separator != NULL && full_write(STDOUT_FILENO, sep, seplen) != seplen)
+		|| copy_fd(a.fds[l], 0, STDOUT_FILENO) != 0
+		|| (b->separator == NULL && b->null && full_write(STDOUT_FILENO, sep, 1) != 1)) {
+			error(0, errno, "Writing to stdout");
+			status = 1;
+		}
+	}
+
+	for (size_t l=0; l < a.count; l++) close(a.fds[l]);
+	free(a.fds);
+	return status;
+}
@@ -0,0 +1,40 @@
+// Editing many inputs in one editor session.
+#ifndef BATCH_H
+#define BATCH_H
+
+// Standard Includes
+#include <stdbool.h>
+#include <stddef.h>
+
+// Internal Includes
+#include <mvipe.h>
+
+/* NOTE:
+ *  Every input is captured into its own storage area and all of them are
+ *  handed to the editor at once, so it can move between them as buffers.
+ *  When there are too many for ARG_MAX the library splits them over several
+ *  editors, one after the other. Once every editor has closed, the results
+ *  are written back.
+ */
+
+struct batch {
+	// Files to edit, or none to read NUL separated records from stdin.
+	const char **from;
+	size_t nfrom;
+	bool null; // Split stdin on NUL.
+	bool in_place; // Write each file back over itself instead of stdout.
+	// Written between results on stdout. With `null` and no separator each
+	// result is NUL terminated instead, so the output splits the same way.
+	const char *separator;
+};
+
+/**
+ * @description - Captures every input, edits them together and writes the
+ *   results back.
+ * @argument opts - settings for the library
+ * @argument b - what to edit and where the results go
+ * @return - the exit status.
+ */
+int batch_run(const struct mvipe_options *opts, const struct batch *b);
+
+#endif /* BATCH_H */
@@ -0,0 +1,304 @@
+// Resident `m-vipe --daemon` and the `--client` that talks to it.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <gnulib/full-read.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "daemon.h"
+
+
+// Sent ahead of the strings, together with the fds.
+struct daemon_request {
+	uint32_t argc;
+	uint32_t nenv;
+	uint32_t size; // Bytes of NUL terminated strings that follow.
+};
+
+// Generous next to ARG_MAX, small enough that a bogus header can't hurt.
+#define DAEMON_REQUEST_MAX (4 << 20)
+
+// stdin, stdout, stderr, working directory and, when there is one, the tty.
+#define DAEMON_FDS 5
+
+// The client's terminal and locale decide how the editor should draw, its
+// VISUAL, EDITOR and PATH which editor that is, and its NVIM, TMUX or STY
+// where it opens. Any of these the client doesn't have, it doesn't get from
+// the daemon either.
+static const char *const forwarded_env[] = {
+	"TERM", "COLORTERM", "LANG", "LC_ALL", "LC_CTYPE",
+	"VISUAL", "EDITOR", "PATH", "NVIM", "NVIM_LISTEN_ADDRESS", "TMUX", "STY", NULL,
+};
+
+
+char *daemon_socket_path(void) {
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (dir == NULL || *dir == '\0') return NULL;
+
+	char *path = xmalloc(strlen(dir) + sizeof("/m-vipe.sock"));
+	strcpy(path, dir);
+	strcat(path, "/m-vipe.sock");
+	return path;
+}
+
+/**
+ * @description - Fills in a unix socket address.
+ * @return - zero on success, -1 with errno set when path doesn't fit.
+ */
+static int socket_address(struct sockaddr_un *addr, const char *path) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+int daemon_client(const char *path, int argc, const char **argv) {
+	struct sockaddr_un addr;
+	struct daemon_request req = { .argc = (uint32_t) argc };
+
+	if (socket_address(&addr, path) != 0) return -1;
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) return -1;
+	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		close(sock);
+		return -1;
+	}
+
+	// Arguments then NAME=VALUE pairs, back to back.
+	for (int l=0; l < argc; l++) req.size += strlen(argv[l]) + 1;
+	for (size_t l=0; forwarded_env[l] != NULL; l++) {
+		const char *value = getenv(forwarded_env[l]);
+		if (value == NULL) continue;
+		req.size += strlen(forwarded_env[l]) + strlen(value) + 2;
+		req.nenv++;
+	}
+
+	char *payload = xmalloc(req.size), *at = payload;
+	for (int l=0; l < argc; l++) at = stpcpy(at, argv[l]) + 1;
+	for (size_t l=0; forwarded_env[l] != NULL; l++) {
+		const char *value = getenv(forwarded_env[l]);
+		if (value == NULL) continue;
+		at = stpcpy(at, forwarded_env[l]);
+		*at++ = '=';
+		at = stpcpy(at, value) + 1;
+	}
+
+	int fds[DAEMON_FDS] = {
+		STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO,
+		open(".", O_PATH | O_DIRECTORY | O_CLOEXEC),
+		open("/dev/tty", O_RDWR | O_NOCTTY | O_CLOEXEC),
+	};
+	size_t nfds = fds[4] < 0 ? DAEMON_FDS-1 : DAEMON_FDS;
+
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = CMSG_SPACE(nfds * sizeof(int)),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+	int32_t status = 1;
+	if (fds[3] < 0)
+		error(0, errno, "Couldn't open working directory");
+	else if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(req)
+	|| full_write(sock, payload, req.size) != req.size)
+		error(0, errno, "Couldn't hand request to daemon");
+	// The daemon has our fds now; all that's left is to wait for its answer.
+	else if (full_read(sock, &status, sizeof(status)) != sizeof(status)) {
+		error(0, errno, "Daemon hung up");
+		status = 1;
+	}
+
+	if (fds[3] >= 0) close(fds[3]);
+	if (fds[4] >= 0) close(fds[4]);
+	free(payload);
+	close(sock);
+	return (int) status;
+}
+
+// Where the request being handled answers, until it has.
+static int answer_conn = -1;
+
+/**
+ * @description - Sends the client its exit status. Registered with on_exit,
+ *   so options that exit on their own, like `--help` or a usage error, still
+ *   answer with theirs rather than leaving the client to find a hang up.
+ */
+static void answer(int status, void *arg) {
+	int32_t code = status;
+	if (answer_conn < 0) return;
+	// Whatever was printed belongs before the client's prompt comes back.
+	fflush(NULL);
+	send(answer_conn, &code, sizeof(code), MSG_NOSIGNAL);
+	answer_conn = -1;
+}
+
+/**
+ * @description - Receives one request and runs it. Takes over the client's
+ *   fds as stdin, stdout, stderr and working directory first, so the
+ *   handler behaves as if the client had run it.
+ * @argument conn - connection to the client
+ * @argument handler - runs the request
+ * @return - the exit status for this child.
+ */
+static int daemon_handle(int conn, daemon_handler *handler) {
+	struct daemon_request req;
+	struct ucred cred;
+	socklen_t credlen = sizeof(cred);
+	int fds[DAEMON_FDS];
+	size_t nfds = 0;
+
+	// XDG_RUNTIME_DIR is private already; this only guards against a socket
+	// path pointed somewhere it shouldn't be.
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) != 0
+	|| cred.uid != geteuid())
+		return 1;
+	answer_conn = conn;
+	on_exit(&answer, NULL);
+
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+	};
+	ssize_t got = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+		nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
+	}
+
+	if (got != sizeof(req) || nfds < DAEMON_FDS-1 || (msg.msg_flags & MSG_CTRUNC)
+	|| req.argc == 0 || req.size > DAEMON_REQUEST_MAX)
+		return 1;
+
+	char *payload = xmalloc(req.size + 1);
+	if (full_read(conn, payload, req.size) != req.size) return 1;
+	payload[req.size] = '\0'; // So a short count can't walk off the end.
+
+	const char **argv = xcalloc(req.argc + 1, sizeof(char*));
+	char *at = payload, *end = payload + req.size;
+	for (size_t l=0; forwarded_env[l] != NULL; l++) unsetenv(forwarded_env[l]);
+	for (uint32_t l=0; l < req.argc + req.nenv; l++) {
+		if (at >= end) return 1;
+		if (l < req.argc) argv[l] = at;
+		else putenv(at);
+		at += strlen(at) + 1;
+	}
+
+	for (int l=0; l < 3; l++) dup2(fds[l], l);
+	if (fchdir(fds[3]) != 0) {
+		error(0, errno, "Couldn't enter working directory");
+		return 1;
+	}
+	for (int l=0; l < 4; l++) close(fds[l]);
+
+	int status = handler((int) req.argc, argv, nfds == DAEMON_FDS ? fds[4] : 0);
+	answer(status, NULL);
+	return status;
+}
+
+static void on_child(int signo) {
+	// Only here to interrupt accept; children are reaped in the main loop.
+}
+
+int daemon_serve(const char *path, daemon_handler *handler) {
+	struct sockaddr_un addr;
+
+	if (socket_address(&addr, path) != 0) {
+		error(0, errno, "Couldn't use socket '%s'", path);
+		return 1;
+	}
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		error(0, errno, "Couldn't create socket");
+		return 1;
+	}
+
+	// Refuse to take over from a live daemon, but clean up after a dead one.
+	int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (probe >= 0 && connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+		error(0, EADDRINUSE, "A daemon is already listening on '%s'", path);
+		close(probe);
+		close(sock);
+		return 1;
+	}
+	if (probe >= 0) close(probe);
+	unlink(path);
+
+	mode_t mask = umask(0177);
+	int bound = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+	umask(mask);
+	if (bound != 0 || listen(sock, SOMAXCONN) != 0) {
+		error(0, errno, "Couldn't listen on '%s'", path);
+		return 1;
+	}
+
+	struct sigaction child = { .sa_handler = &on_child };
+	sigemptyset(&child.sa_mask);
+	sigaction(SIGCHLD, &child, NULL);
+
+	while (true) {
+		while (waitpid(-1, NULL, WNOHANG) > 0);
+
+		int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			error(0, errno, "Couldn't accept client");
+			break;
+		}
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			// Each request gets its own session, away from the daemon's
+			// terminal, and the default SIGCHLD the library expects.
+			close(sock);
+			setsid();
+			signal(SIGCHLD, SIG_DFL);
+			exit(daemon_handle(conn, handler));
+		}
+		if (pid < 0) error(0, errno, "Couldn't fork for client");
+		close(conn);
+	}
+
+	close(sock);
+	unlink(path);
+	return 1;
+}
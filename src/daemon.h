@@ -0,0 +1,56 @@
+// Resident `m-vipe --daemon` and the `--client` that talks to it.
+#ifndef DAEMON_H
+#define DAEMON_H
+
+/* NOTE:
+ *  The client connects to a per-user unix socket and passes its stdin,
+ *  stdout, stderr, working directory and terminal over SCM_RIGHTS, followed
+ *  by its arguments and the variables that choose and place the editor. The
+ *  daemon forks a child per client which takes those fds and variables as
+ *  its own, runs the request like a local m-vipe would and answers with the
+ *  exit status. Children inherit the daemon's warm editor resolution, so a
+ *  client with the same PATH, VISUAL, EDITOR and TERM as the daemon never
+ *  has to search PATH or find a terminal itself; any other resolves afresh.
+ *
+ *  The editor runs on the client's terminal but isn't in its session, so
+ *  the shell's job control (^Z) and SIGWINCH don't reach it. Editors that
+ *  query the window size on redraw are unaffected.
+ */
+
+/**
+ * @description - Runs one request. Called in a forked child whose stdin,
+ *   stdout, stderr and working directory are the client's.
+ * @argument argc - argument count, including the program name
+ * @argument argv - the client's arguments
+ * @argument tty - the client's terminal, or zero when it had none
+ * @return - the exit status to report to the client.
+ */
+typedef int daemon_handler(int argc, const char **argv, int tty);
+
+/**
+ * @description - Where the daemon listens. Lives in XDG_RUNTIME_DIR, which is
+ *   private to the user and cleared on logout.
+ * @return - a malloc allocated path, or NULL when XDG_RUNTIME_DIR is unset.
+ */
+char *daemon_socket_path(void);
+
+/**
+ * @description - Serves requests on path until killed.
+ * @argument path - the socket to listen on
+ * @argument handler - runs each request
+ * @return - an exit status, only when the daemon couldn't start or stopped
+ *   unexpectedly.
+ */
+int daemon_serve(const char *path, daemon_handler *handler);
+
+/**
+ * @description - Hands this process's request to a running daemon and waits
+ *   for it to finish.
+ * @argument path - the daemon's socket
+ * @argument argc - argument count, including the program name
+ * @argument argv - arguments to forward
+ * @return - the request's exit status, or -1 when no daemon is listening.
+ */
+int daemon_client(const char *path, int argc, const char **argv);
+
+#endif /* DAEMON_H */
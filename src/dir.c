@@ -0,0 +1,387 @@
+// Editing a directory listing to rename and delete its entries, like vidir.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "dir.h"
+#include "ioblksize.h"
+
+
+// What getdents64 fills its buffer with. glibc only wraps it since 2.30.
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+// Big enough that even huge directories only take a handful of calls.
+#define DIR_BUFSIZE (1 << 20)
+
+enum change { KEEP, MOVE, DELETE };
+
+struct entry {
+	char *name;
+	char *dest; // New name, only for MOVE.
+	unsigned char type; // d_type, DT_UNKNOWN when the filesystem won't say.
+	enum change change;
+	// Renames are worked through as chains; `mark` is 0 until the entry is
+	// on the chain being walked (1, at `pos`), and 2 once it's been moved.
+	unsigned char mark;
+	size_t pos;
+};
+
+struct listing {
+	int dirfd;
+	bool verbose;
+	struct entry *entries;
+	size_t count;
+	char *names; // Every name back to back, NUL terminated.
+	unsigned temps; // Temporary names handed out so far.
+};
+
+static int entry_cmp(const void *a, const void *b) {
+	return strcmp(((const struct entry *) a)->name, ((const struct entry *) b)->name);
+}
+
+static int name_cmp(const void *a, const void *b) {
+	return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+/**
+ * @description - Reads every entry of the directory, then sorts them.
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int list_dir(struct listing *ls) {
+	char *buf = xmalloc(DIR_BUFSIZE);
+	size_t cap = 0, size = 0, namecap = 0;
+	long got;
+
+	// Names are collected as offsets; the arena moves while it grows.
+	while ((got = syscall(SYS_getdents64, ls->dirfd, buf, DIR_BUFSIZE)) > 0) {
+		for (long at = 0; at < got;) {
+			struct linux_dirent64 *d = (struct linux_dirent64 *) (buf + at);
+			at += d->d_reclen;
+			if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+			// Such an entry can't be listed, so leave it alone entirely.
+			if (strchr(d->d_name, '\n') != NULL) {
+				error(0, 0, "Skipping a name with a newline in it");
+				continue;
+			}
+
+			size_t len = strlen(d->d_name) + 1;
+			while (size + len > namecap) ls->names = x2nrealloc(ls->names, &namecap, 1);
+			memcpy(ls->names + size, d->d_name, len);
+			if (ls->count == cap) ls->entries = x2nrealloc(ls->entries, &cap, sizeof(struct entry));
+			ls->entries[ls->count++] = (struct entry) {
+				.name = (char *) (uintptr_t) size,
+				.type = d->d_type,
+			};
+			size += len;
+		}
+	}
+	free(buf);
+	if (got < 0) return -1;
+
+	for (size_t l=0; l < ls->count; l++)
+		ls->entries[l].name = ls->names + (uintptr_t) ls->entries[l].name;
+	if (ls->count != 0) qsort(ls->entries, ls->count, sizeof(struct entry), &entry_cmp);
+	return 0;
+}
+
+/**
+ * @description - Writes the numbered listing into the storage area.
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int write_listing(const struct listing *ls, int fd) {
+	char *buf = xmalloc(IO_BUFSIZE);
+	size_t used = 0;
+	int width = snprintf(NULL, 0, "%zu", ls->count);
+
+	for (size_t l=0; l < ls->count; l++) {
+		const char *name = ls->entries[l].name;
+		size_t need = (size_t) width + strlen(name) + 2;
+		if (used + need > IO_BUFSIZE) {
+			if (full_write(fd, buf, used) != used) break;
+			used = 0;
+		}
+		// A single name can't be longer than NAME_MAX, far below the buffer.
+		used += (size_t) sprintf(buf + used, "%0*zu\t%s\n", width, l+1, name);
+	}
+	int status = full_write(fd, buf, used) == used ? 0 : -1;
+	free(buf);
+	return status;
+}
+
+/**
+ * @description - Reads back the edited listing and works out what changes.
+ *   Nothing is applied here, so a mistake anywhere changes nothing.
+ * @argument edited - the storage area's contents, NUL terminated; the new
+ *   names point into it
+ * @return - zero when the edit makes sense, -1 once the problem is reported.
+ */
+static int plan_changes(struct listing *ls, char *edited) {
+	bool *seen = xcalloc(ls->count + 1, sizeof(bool));
+	size_t lineno = 0;
+	int status = 0;
+
+	for (char *line = edited, *next; *line != '\0' && status == 0; line = next) {
+		lineno++;
+		next = strchrnul(line, '\n');
+		if (*next != '\0') *next++ = '\0';
+		if (*line == '\0') continue;
+
+		char *name;
+		errno = 0;
+		unsigned long long number = strtoull(line, &name, 10);
+		if (name == line || *name != '\t' || errno != 0) {
+			error(0, 0, "Line %zu isn't NUMBER<TAB>NAME", lineno);
+			status = -1;
+		}
+		else if (number == 0 || number > ls->count || seen[number]) {
+			error(0, 0, "Line %zu: %s item number %llu", lineno,
+				number == 0 || number > ls->count ? "unknown" : "duplicated", number);
+			status = -1;
+		}
+		else if (*++name == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+			error(0, 0, "Line %zu: '%s' can't be a name", lineno, name);
+			status = -1;
+		}
+		else {
+			struct entry *e = &ls->entries[number - 1];
+			seen[number] = true;
+			if (strcmp(name, e->name) != 0) {
+				e->change = MOVE;
+				e->dest = name;
+			}
+		}
+	}
+
+	for (size_t l=0; l < ls->count; l++)
+		if (seen[l+1] != true) ls->entries[l].change = DELETE;
+	free(seen);
+	if (status != 0) return status;
+
+	// Two entries ending up with the same name would mean losing one.
+	const char **final = xcalloc(ls->count + 1, sizeof(char*));
+	size_t nfinal = 0;
+	for (size_t l=0; l < ls->count; l++) {
+		const struct entry *e = &ls->entries[l];
+		if (e->change != DELETE) final[nfinal++] = e->change == MOVE ? e->dest : e->name;
+	}
+	if (nfinal != 0) qsort(final, nfinal, sizeof(char*), &name_cmp);
+	for (size_t l=1; l < nfinal && status == 0; l++)
+		if (strcmp(final[l-1], final[l]) == 0) {
+			error(0, 0, "More than one entry would be named '%s'", final[l]);
+			status = -1;
+		}
+	free(final);
+	return status;
+}
+
+/**
+ * @description - Finds the entry originally called name.
+ * @return - its index, or -1 when there's none.
+ */
+static ssize_t occupant(const struct listing *ls, const char *name) {
+	struct entry key = { .name = (char *) name };
+	struct entry *e = bsearch(&key, ls->entries, ls->count, sizeof(struct entry), &entry_cmp);
+	return e != NULL ? e - ls->entries : -1;
+}
+
+/**
+ * @description - Renames without ever replacing what's already there.
+ * @return - zero on success, -1 once the failure has been reported.
+ */
+static int move(struct listing *ls, const char *from, const char *to) {
+	int moved = renameat2(ls->dirfd, from, ls->dirfd, to, RENAME_NOREPLACE);
+	// Not every filesystem can promise that; check first instead, which
+	// only leaves a window for a racing creator.
+	if (moved != 0 && errno == EINVAL) {
+		struct stat stat_buf;
+		if (fstatat(ls->dirfd, to, &stat_buf, AT_SYMLINK_NOFOLLOW) == 0) errno = EEXIST;
+		else if (errno == ENOENT) moved = renameat(ls->dirfd, from, ls->dirfd, to);
+	}
+	if (moved != 0) {
+		error(0, errno, "Couldn't rename '%s' to '%s'", from, to);
+		return -1;
+	}
+	if (ls->verbose) fprintf(stderr, "'%s' -> '%s'\n", from, to);
+	return 0;
+}
+
+/**
+ * @description - Moves an entry out of the way under a name nobody uses.
+ * @argument temp - receives the name, at least 64 bytes
+ * @return - zero on success, -1 once the failure has been reported.
+ */
+static int move_aside(struct listing *ls, const char *from, char *temp) {
+	while (true) {
+		snprintf(temp, 64, ".m-vipe-%ld-%u", (long) getpid(), ls->temps++);
+		if (renameat2(ls->dirfd, from, ls->dirfd, temp, RENAME_NOREPLACE) == 0) {
+			if (ls->verbose) fprintf(stderr, "'%s' -> '%s'\n", from, temp);
+			return 0;
+		}
+		if (errno == EEXIST) continue;
+		if (errno == EINVAL) return move(ls, from, temp);
+		error(0, errno, "Couldn't move '%s' out of the way", from);
+		return -1;
+	}
+}
+
+/**
+ * @description - Deletes every entry whose line is gone. Runs before the
+ *   renames, so their names are free to reuse.
+ * @return - the number of failures.
+ */
+static size_t apply_deletes(struct listing *ls) {
+	size_t failed = 0;
+
+	for (size_t l=0; l < ls->count; l++) {
+		struct entry *e = &ls->entries[l];
+		if (e->change != DELETE) continue;
+		// d_type saves a stat per entry; without it, find out the hard way.
+		int gone = unlinkat(ls->dirfd, e->name, e->type == DT_DIR ? AT_REMOVEDIR : 0);
+		if (gone != 0 && e->type == DT_UNKNOWN && errno == EISDIR)
+			gone = unlinkat(ls->dirfd, e->name, AT_REMOVEDIR);
+		if (gone != 0) {
+			error(0, errno, "Couldn't remove '%s'", e->name);
+			failed++;
+		}
+		else if (ls->verbose) fprintf(stderr, "removed '%s'\n", e->name);
+	}
+	return failed;
+}
+
+/**
+ * @description - Renames every entry whose name changed. An entry can only
+ *   move once whatever holds its new name has moved on, so each rename is
+ *   followed along that chain first, and done from the far end back. A
+ *   chain that comes back on itself is a cycle: two entries are swapped in
+ *   one go, longer cycles are opened up with a temporary name.
+ * @return - the number of failures.
+ */
+static size_t apply_moves(struct listing *ls) {
+	size_t *chain = xcalloc(ls->count + 1, sizeof(size_t));
+	size_t failed = 0;
+	char temp[64];
+
+	for (size_t l=0; l < ls->count; l++) {
+		if (ls->entries[l].change != MOVE || ls->entries[l].mark != 0) continue;
+
+		size_t depth = 0, end, cur = l;
+		ssize_t cycle = -1;
+		while (true) {
+			struct entry *e = &ls->entries[cur];
+			e->mark = 1;
+			e->pos = depth;
+			chain[depth++] = cur;
+			ssize_t next = occupant(ls, e->dest);
+			if (next < 0 || ls->entries[next].change != MOVE || ls->entries[next].mark == 2)
+				break;
+			if (ls->entries[next].mark == 1) {
+				cycle = (ssize_t) ls->entries[next].pos;
+				break;
+			}
+			cur = (size_t) next;
+		}
+
+		end = depth;
+		if (cycle >= 0) {
+			struct entry *head = &ls->entries[chain[cycle]];
+			end = (size_t) cycle;
+			if (depth - end == 2 && renameat2(ls->dirfd, head->name, ls->dirfd,
+					ls->entries[chain[end+1]].name, RENAME_EXCHANGE) == 0) {
+				if (ls->verbose)
+					fprintf(stderr, "'%s' <-> '%s'\n", head->name, ls->entries[chain[end+1]].name);
+			}
+			else if (move_aside(ls, head->name, temp) != 0)
+				failed += depth - end;
+			else {
+				for (size_t k = depth - 1; k > end; k--) {
+					struct entry *e = &ls->entries[chain[k]];
+					failed += move(ls, e->name, e->dest) != 0;
+				}
+				failed += move(ls, temp, head->dest) != 0;
+			}
+		}
+		for (size_t k = end; k > 0; k--) {
+			struct entry *e = &ls->entries[chain[k-1]];
+			failed += move(ls, e->name, e->dest) != 0;
+		}
+		for (size_t k=0; k < depth; k++) ls->entries[chain[k]].mark = 2;
+	}
+
+	free(chain);
+	return failed;
+}
+
+int dir_run(const struct mvipe_options *opts, const char *dir) {
+	struct listing ls = { .verbose = opts != NULL && opts->verbose != 0 };
+	struct stat stat_buf;
+	char *edited = NULL;
+	int status = 1, fd = -1;
+
+	ls.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (ls.dirfd < 0 || list_dir(&ls) != 0) {
+		error(0, errno, "Couldn't list '%s'", dir);
+		goto done;
+	}
+	if ((fd = mvipe_storage_open(opts)) < 0 || write_listing(&ls, fd) != 0) {
+		error(0, errno, "Couldn't write the listing");
+		goto done;
+	}
+
+	if (mvipe_edit_fd(opts, fd) != 0) {
+		error(0, errno, "%s", mvipe_strerror());
+		goto done;
+	}
+
+	// The names have to live as long as the plan; read it all in one go.
+	if (fstat(fd, &stat_buf) != 0) goto unreadable;
+	edited = xmalloc((size_t) stat_buf.st_size + 1);
+	for (off_t at = 0; at < stat_buf.st_size;) {
+		ssize_t got = pread(fd, edited + at, (size_t) (stat_buf.st_size - at), at);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) goto unreadable;
+		at += got;
+	}
+	edited[stat_buf.st_size] = '\0';
+
+	if (plan_changes(&ls, edited) == 0) {
+		size_t failed = apply_deletes(&ls);
+		failed += apply_moves(&ls);
+		status = failed != 0;
+	}
+	goto done;
+
+	unreadable:
+	error(0, errno, "Couldn't read back the listing");
+	done:
+	if (fd >= 0) close(fd);
+	if (ls.dirfd >= 0) close(ls.dirfd);
+	free(edited);
+	free(ls.entries);
+	free(ls.names);
+	return status;
+}
@@ -0,0 +1,25 @@
+// Editing a directory listing to rename and delete its entries, like vidir.
+#ifndef DIR_H
+#define DIR_H
+
+// Internal Includes
+#include <mvipe.h>
+
+/* NOTE:
+ *  The listing is one `NUMBER<TAB>NAME` line per entry, sorted by name.
+ *  Changing a name renames that entry and deleting its line deletes it;
+ *  the numbers say which entry a line was, so lines may be reordered
+ *  freely. Nothing is touched until the whole edit has been checked, and
+ *  names are never overwritten: swaps and longer cycles of renames are
+ *  carried out through an exchange or a temporary name.
+ */
+
+/**
+ * @description - Lists dir, lets the user edit the listing and applies it.
+ * @argument opts - settings for the library
+ * @argument dir - the directory to edit
+ * @return - the exit status, 1 when any change couldn't be made.
+ */
+int dir_run(const struct mvipe_options *opts, const char *dir);
+
+#endif /* DIR_H */
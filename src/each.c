@@ -0,0 +1,161 @@
+// Filtering many files in place with a pool of workers.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <error.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <gnulib/safe-read.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "each.h"
+#include "ioblksize.h"
+
+
+struct pool {
+	const struct mvipe_options *opts;
+	const char **files;
+	size_t nfiles;
+	// Every worker takes the next file off the same counter, so whoever
+	// finishes early just takes more; no file waits behind a slow one.
+	atomic_size_t next;
+	atomic_size_t failed;
+};
+
+/**
+ * @description - Copies a whole file, letting the kernel share or clone the
+ *   blocks where the filesystem can.
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int copy_file(int from, int to) {
+	ssize_t got;
+
+	while ((got = copy_file_range(from, NULL, to, NULL, IO_BUFSIZE * 64, 0)) > 0);
+	if (got == 0) return 0;
+	// Old kernels, and some filesystem pairs, can't; fall back to copying.
+	if (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP)
+		return -1;
+
+	char buf[IO_BUFSIZE];
+	size_t n;
+	while ((n = safe_read(from, buf, sizeof(buf))) != 0) {
+		if (n == SAFE_READ_ERROR || full_write(to, buf, n) != n) return -1;
+	}
+	return 0;
+}
+
+/**
+ * @description - Filters one file through a copy beside it, then renames
+ *   the copy over the original.
+ * @return - zero on success, -1 once the failure has been reported.
+ */
+static int each_file(const struct mvipe_options *opts, const char *path) {
+	struct stat stat_buf;
+	const char *what = "Couldn't open";
+	int in = -1, out = -1;
+
+	// The copy has to be on the same filesystem for the rename, so it goes in
+	// the same directory, hidden.
+	const char *base = strrchr(path, '/');
+	size_t dirlen = base != NULL ? (size_t) (base - path) + 1 : 0;
+	base = base != NULL ? base + 1 : path;
+	char *tmp = xmalloc(dirlen + strlen(base) + sizeof(".m-vipe-XXXXXX") + 1);
+	memcpy(tmp, path, dirlen);
+	strcpy(tmp + dirlen, ".");
+	strcat(tmp + dirlen, base);
+	strcat(tmp + dirlen, ".m-vipe-XXXXXX");
+
+	if ((in = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(in, &stat_buf) != 0)
+		goto fail;
+	what = "Not a regular file";
+	if (!S_ISREG(stat_buf.st_mode)) {
+		errno = 0;
+		goto fail;
+	}
+	what = "Couldn't copy";
+	if ((out = mkostemp(tmp, O_CLOEXEC)) < 0) goto fail;
+	if (copy_file(in, out) != 0) goto unlink;
+	// Keep who may read it; the owner only follows when we're allowed to.
+	if (fchmod(out, stat_buf.st_mode & 07777) != 0) goto unlink;
+	if (fchown(out, stat_buf.st_uid, stat_buf.st_gid) != 0) errno = 0;
+
+	// By name, so a filter that renames its own copy over it, like `sed -i`,
+	// can make that copy beside ours; the rename below takes whatever is at
+	// tmp by then.
+	if (mvipe_filter_path(opts, tmp) != 0) {
+		error(0, errno, "%s: %s", path, mvipe_strerror());
+		unlink(tmp);
+		goto done;
+	}
+	what = "Couldn't replace";
+	if (rename(tmp, path) != 0) goto unlink;
+
+	close(in);
+	close(out);
+	free(tmp);
+	return 0;
+
+	unlink:
+	unlink(tmp);
+	fail:
+	error(0, errno, "%s '%s'", what, path);
+	done:
+	if (in >= 0) close(in);
+	if (out >= 0) close(out);
+	free(tmp);
+	return -1;
+}
+
+static void *each_worker(void *arg) {
+	struct pool *pool = arg;
+	size_t l;
+
+	while ((l = atomic_fetch_add(&pool->next, 1)) < pool->nfiles)
+		if (each_file(pool->opts, pool->files[l]) != 0)
+			atomic_fetch_add(&pool->failed, 1);
+	return NULL;
+}
+
+int each_run(const struct mvipe_options *opts, const char **files, size_t nfiles,
+		unsigned jobs) {
+	struct pool pool = { .opts = opts, .files = files, .nfiles = nfiles };
+
+	if (jobs == 0) jobs = (unsigned) MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+	size_t nworkers = MIN((size_t) jobs, nfiles);
+
+	// Resolve the editor once up front; every worker then finds it cached.
+	if (nfiles != 0 && mvipe_prepare(opts) != 0) {
+		error(0, errno, "%s", mvipe_strerror());
+		return 1;
+	}
+
+	// The calling thread is a worker too.
+	pthread_t *workers = xcalloc(MAX(nworkers, 1), sizeof(pthread_t));
+	size_t started = 0;
+	for (; started + 1 < nworkers; started++)
+		if ((errno = pthread_create(&workers[started], NULL, &each_worker, &pool)) != 0) {
+			// Fewer workers is still correct, just slower.
+			if (opts != NULL && opts->verbose != 0) error(0, errno, "Error: Couldn't start a worker");
+			break;
+		}
+	each_worker(&pool);
+	for (size_t l=0; l < started; l++) pthread_join(workers[l], NULL);
+	free(workers);
+
+	size_t failed = atomic_load(&pool.failed);
+	if (failed != 0) error(0, 0, "%zu of %zu files failed", failed, nfiles);
+	return failed != 0;
+}
@@ -0,0 +1,31 @@
+// Filtering many files in place with a pool of workers.
+#ifndef EACH_H
+#define EACH_H
+
+// Standard Includes
+#include <stddef.h>
+
+// Internal Includes
+#include <mvipe.h>
+
+/* NOTE:
+ *  Unlike a batch, which gives all of its inputs to one person, `--each`
+ *  expects a script for an editor and runs it on every file by itself.
+ *  Each file is copied next to itself, filtered there and renamed back over
+ *  the original, so a reader never sees a half written file and a failed
+ *  filter leaves the original untouched. Failures are reported per file and
+ *  don't stop the rest.
+ */
+
+/**
+ * @description - Filters every file in place.
+ * @argument opts - settings for the library; the editor is run as a filter
+ * @argument files - the files to filter
+ * @argument nfiles - number of files
+ * @argument jobs - files to filter at once, or zero for one per processor
+ * @return - the exit status, 1 when any file failed.
+ */
+int each_run(const struct mvipe_options *opts, const char **files, size_t nfiles,
+	unsigned jobs);
+
+#endif /* EACH_H */
@@ -0,0 +1,229 @@
+// Variadic argument helpers used to build the editor's command line.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <error.h>
+
+// External Includes
+#include <unistd.h> // may need to be included before string.h for strdup
+
+// Internal Includes
+#include "internal.h"
+
+
+/**
+ * @description - Performs path search, shell argument expansion and
+ *   concatenation of variadic string arguments. Will set errno on error.
+ *   All errors inherited from realloc and access.
+ * @argument str - previously malloc allocated string to add
+ * @argument argv - malloc allocated variadic argument container
+ * @argument argc - a pointer to the count of variadic arguments contain by argv
+ * @return - True when str contained a command found in PATH, false otherwise.
+ */
+bool shexpaccvar(char **str, char ***argv, size_t *argc) {
+	// Use two pass algorithm to decide whether or not we need to extend the
+	// variadic args list. Use binary exponential growth when expanding like
+	// C++ strings for malloc efficency.
+
+	// TODO: make this function and shpaccvar not fail when user supplied full path.
+	if (*str == NULL) return false;
+
+	// NOTE: This isn't actually a "correct" use for IFS. Though it's not very far off.
+	//   See: https://web.archive.org/web/20210513070928/http://mywiki.wooledge.org/IFS
+	char *ifs = " \t\n";
+	char *path = getenv("PATH"); if (path == NULL) path="";
+	size_t slenb = strlen(*str) * sizeof(char);
+	size_t plenb = strlen(path) * sizeof(char);
+
+	// Count the new arguments after IFS parsing and prep reuse of str in-place
+	size_t nc = *argc+1;
+	for (char *c, *acc=*str; (c=strpbrk(acc, ifs)) != NULL; acc=c+sizeof(char)) {
+		nc++;
+		*c = '\0';
+	}
+
+	// Extend the argument pointer array if necessary.
+	size_t nb = BINALLOC(sizeof(void*), nc+1);
+	size_t ob = BINALLOC(sizeof(void*), (*argc)+1);
+	if (nb >= ob) {
+		if (*argv == NULL)
+			*argv = malloc(nb);
+		else
+			*argv = realloc(*argv, nb);
+		if (*argv == NULL)
+			return false;
+	}
+
+	if (access(*str, R_OK | X_OK) != 0) {
+		// Reallocate str to buffer PATH search
+		*str = realloc(*str, plenb + slenb + 2*sizeof(char)); // + pathsep & NULL
+		if (*str == NULL) return false;
+
+		// NOTE: remove when regression testing is finished.
+		*((*str)+plenb+slenb) = '\0'; // append null to reallocated space as a precaution
+
+		// perform PATH search
+		char *c, *sloc=*str, *pacc=path;
+		for (;(c=strpbrk(pacc, ":")) != NULL; pacc=c+sizeof(char)) {
+			// move str value to be in front of path segment, then memcpy path
+			// into place.
+			plenb = c - pacc;
+			sloc=memmove((*str)+plenb+sizeof(char), sloc, slenb+sizeof(char));
+			memcpy(*str, pacc, plenb);
+			*((*str)+plenb) = '/'; // replace fieldsep with POSIX pathsep
+
+			int s = access(*str, R_OK | X_OK);
+			if (s == 0) break;
+		}
+		// Final pass / when IFS not found
+		if (c == NULL) {
+			plenb = strlen(pacc) * sizeof(char);
+			sloc=memmove((*str)+plenb+sizeof(char), sloc, slenb+sizeof(char));
+			memcpy(*str, pacc, plenb);
+			*((*str)+plenb) = '/';
+
+			int s = access(*str, R_OK | X_OK);
+			if (s == -1) return false;
+		}
+		slenb += plenb+sizeof(char);
+	}
+
+	// Populate args from buffer
+	errno=0;
+	(*argv)[(*argc)++] = *str;
+	for (size_t l=0; l < (slenb/sizeof(char)); l++)
+		if ((*str)[l] == '\0')
+			(*argv)[(*argc)++] = &((*str)[l+1]);
+
+	(*argv)[*argc] = (char *) NULL;
+	return true;;
+}
+
+bool shpaccvar(char **str, char ***argv, size_t *argc) {
+	// Use two pass algorithm to decide whether or not we need to extend the
+	// variadic args list. Use binary exponential growth when expanding like
+	// C++ strings for malloc efficency.
+
+	if (*str == NULL) return false;
+
+	char *path = getenv("PATH");
+	size_t slenb = strlen(*str) * sizeof(char);
+	size_t plenb = strlen(path) * sizeof(char);
+
+	// Extend the argument pointer array if necessary.
+	size_t nc = *argc+1;
+	size_t nb = BINALLOC(sizeof(void*), nc+1);
+	size_t ob = BINALLOC(sizeof(void*), (*argc)+1);
+	if (nb >= ob) {
+		if (*argv == NULL)
+			*argv = malloc(nb);
+		else
+			*argv = realloc(*argv, nb);
+		if (*argv == NULL)
+			return false;
+	}
+
+	if (access(*str, R_OK | X_OK) != 0) {
+		// Reallocate str to buffer PATH search
+		*str = realloc(*str, plenb + slenb + 2*sizeof(char)); // + pathsep & NULL
+		if (*str == NULL) return false;
+
+		// NOTE: remove when regression testing is finished.
+		*((*str)+plenb+slenb) = '\0'; // append null to reallocated space as a precaution
+
+		// perform PATH search
+		char *c, *sloc=*str, *pacc=path;
+		for (;(c=strpbrk(pacc, ":")) != NULL; pacc=c+sizeof(char)) {
+			// move str value to be in front of path segment, then memcpy path
+			// into place.
+			plenb = c - pacc;
+			sloc = memmove((*str)+plenb+sizeof(char), sloc, slenb+sizeof(char));
+			memcpy(*str, pacc, plenb);
+			*((*str)+plenb) = '/'; // replace fieldsep with POSIX pathsep
+
+			int s = access(*str, R_OK | X_OK);
+			if (s == 0) break;
+		}
+		// Final pass / when IFS not found
+		if (c == NULL) {
+			plenb = strlen(pacc) * sizeof(char);
+			sloc = memmove((*str)+plenb+sizeof(char), sloc, slenb+sizeof(char));
+			memcpy(*str, pacc, plenb);
+			*((*str)+plenb) = '/';
+
+			int s = access(*str, R_OK | X_OK);
+			if (s == -1) return false;
+		}
+	}
+
+	// Populate args from buffer
+	errno=0;
+	(*argv)[(*argc)++] = *str;
+	(*argv)[*argc] = (char *) NULL;
+	return true;;
+}
+
+bool pushvar(char **str, char ***argv, size_t *argc) {
+	size_t nb = BINALLOC(sizeof(void*) , (*argc)+2);
+	size_t ob = BINALLOC(sizeof(void*), (*argc)+1);
+	if (nb >= ob) {
+		if (*argv == NULL)
+			*argv = malloc(nb);
+		else
+			*argv = realloc(*argv, nb);
+		if (*argv == NULL)
+			return false;
+	}
+
+	errno=0;
+	(*argv)[(*argc)++] = *str;
+	(*argv)[*argc] = (char *) NULL;
+	return true;
+}
+
+bool ccvar(char ***toargv, size_t *toargc, char **fromargv, size_t fromargc) {
+	size_t nc = (*toargc)+fromargc;
+
+	size_t nb = BINALLOC(sizeof(void*), nc+1);
+	size_t ob = BINALLOC(sizeof(void*), (*toargc)+1);
+	if (nb >= ob) {
+		if (*toargv == NULL)
+			*toargv = malloc(nb);
+		else
+			*toargv = realloc(*toargv, nb);
+		if (*toargv == NULL)
+			return false;
+	}
+
+	for (size_t l=0; *toargc < nc; (*toargc)++)
+		(*toargv)[*toargc] = fromargv[l++];
+
+	errno=0;
+	(*toargv)[*toargc] = (char *) NULL;
+	return true;
+}
+
+/**
+ * @description - Reports why the last candidate didn't work out, with
+ *   verbose, before the next one is tried.
+ * @return - false when errno is one no other candidate will get past, like
+ *   ENOMEM, so the caller should give up with it instead.
+ */
+bool passive_error(int verbose, const char* message) {
+	switch (errno) {
+		case 0: return true;
+		// A library can't exit on its host, fatal or not; the caller fails.
+		case ENOMEM: case EHWPOISON: case ENOSPC:
+			return false;
+		default:
+			if (verbose != 0)
+				error(0, errno, "Error: %s", message);
+			return true;
+	}
+}
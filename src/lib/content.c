@@ -0,0 +1,149 @@
+// What the input looks like, measured while it's captured.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// External Includes
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Internal Includes
+#include "internal.h"
+
+
+/* NOTE:
+ *  This runs on every block capture copies, so it has to keep up with it.
+ *  Input is taken 64 bytes at a time and turned into three bitmasks:
+ *  newlines, NULs, and bytes with the top bit set. With SSE2, which every
+ *  x86-64 has, that's a dozen instructions; elsewhere a plain loop the
+ *  compiler can widen. Lines then cost a few bit operations per newline,
+ *  and UTF-8 is only decoded in chunks that aren't plain ASCII, and not at
+ *  all once it's known not to be UTF-8. State that spans two blocks, a line
+ *  or a sequence cut in half, is carried over in the struct.
+ */
+
+#define CHUNK 64
+
+/**
+ * @description - Classifies CHUNK bytes.
+ * @return - a bit per byte that's a newline; nuls and high get one per NUL
+ *   and per byte over 0x7F.
+ */
+static inline uint64_t chunk_masks(const unsigned char *p, uint64_t *nuls, uint64_t *high) {
+	uint64_t nl = 0;
+	*nuls = *high = 0;
+#ifdef __SSE2__
+	const __m128i newline = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+	for (int l=0; l < CHUNK / 16; l++) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + 16 * l));
+		nl |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << (16 * l);
+		*nuls |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) << (16 * l);
+		*high |= (uint64_t) (uint16_t) _mm_movemask_epi8(v) << (16 * l);
+	}
+#else
+	for (int l=0; l < CHUNK; l++) {
+		nl |= (uint64_t) (p[l] == '\n') << l;
+		*nuls |= (uint64_t) (p[l] == '\0') << l;
+		*high |= (uint64_t) (p[l] >> 7) << l;
+	}
+#endif
+	return nl;
+}
+
+static void utf8_scan(struct content *c, const unsigned char *at, size_t len) {
+	const unsigned char *end = at + len;
+	uint64_t word;
+
+	while (at < end) {
+		if (c->need == 0 && end - at >= 8) {
+			memcpy(&word, at, sizeof(word));
+			if ((word & 0x8080808080808080ULL) == 0) { at += 8; continue; }
+		}
+
+		unsigned char b = *at++;
+		if (c->need != 0) {
+			if (b < c->lo || b > c->hi) { c->invalid = true; return; }
+			c->lo = 0x80; c->hi = 0xBF;
+			c->need--;
+			continue;
+		}
+		if (b < 0x80) continue;
+
+		// Ranges for the second byte rule out overlong forms and surrogates.
+		c->lo = 0x80; c->hi = 0xBF;
+		if (b >= 0xC2 && b <= 0xDF) c->need = 1;
+		else if (b >= 0xE0 && b <= 0xEF) {
+			c->need = 2;
+			if (b == 0xE0) c->lo = 0xA0;
+			if (b == 0xED) c->hi = 0x9F;
+		}
+		else if (b >= 0xF0 && b <= 0xF4) {
+			c->need = 3;
+			if (b == 0xF0) c->lo = 0x90;
+			if (b == 0xF4) c->hi = 0x8F;
+		}
+		else { c->invalid = true; return; }
+	}
+}
+
+// Takes n bytes at p, with their masks, into the counts.
+static void content_chunk(struct content *c, const unsigned char *p, unsigned n,
+		uint64_t nl, uint64_t nuls, uint64_t high) {
+	if (c->lines) {
+		unsigned at = 0;
+		for (; nl != 0; nl &= nl - 1) {
+			unsigned bit = (unsigned) __builtin_ctzll(nl);
+			c->line += bit - at;
+			c->longest = MAX(c->longest, c->line);
+			c->nlines++;
+			c->line = 0;
+			at = bit + 1;
+		}
+		c->line += n - at;
+	}
+
+	if (c->text) {
+		c->nuls += (uint64_t) __builtin_popcountll(nuls);
+		if (c->invalid != true && (high != 0 || c->need != 0)) utf8_scan(c, p, n);
+	}
+}
+
+void content_scan(struct content *c, const char *buf, size_t len) {
+	const unsigned char *p = (const unsigned char *) buf;
+	uint64_t nl, nuls, high;
+
+	if (c->lines != true && c->text != true) return;
+	for (; len >= CHUNK; p += CHUNK, len -= CHUNK) {
+		nl = chunk_masks(p, &nuls, &high);
+		content_chunk(c, p, CHUNK, nl, nuls, high);
+	}
+	if (len == 0) return;
+
+	// The tail goes through the same path, padded, with the padding masked.
+	unsigned char tail[CHUNK] = { 0 };
+	uint64_t keep = ((uint64_t) 1 << len) - 1;
+	memcpy(tail, p, len);
+	nl = chunk_masks(tail, &nuls, &high);
+	content_chunk(c, tail, (unsigned) len, nl & keep, nuls & keep, high & keep);
+}
+
+void content_end(struct content *c) {
+	// An unterminated last line is still a line.
+	if (c->line != 0) {
+		c->longest = MAX(c->longest, c->line);
+		c->nlines++;
+		c->line = 0;
+	}
+	if (c->need != 0) c->invalid = true;
+	c->need = 0;
+}
+
+bool content_binary(const struct content *c) {
+	return c->text && (c->nuls != 0 || c->invalid);
+}
@@ -0,0 +1,430 @@
+// Terminal and editor resolution.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+// External Includes
+#include <unistd.h> // may need to be included before string.h for strdup
+#include <spawn.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+/* NOTE:
+ *  Resolved commands are remembered for the life of the process, so a long
+ *  running host (like `m-vipe --daemon`) only searches PATH once per editor.
+ *  Forked children inherit whatever their parent had already resolved. Each
+ *  is kept with the environment it was resolved under and only recalled
+ *  under the same one, so a client with its own EDITOR or PATH gets its own
+ *  editor rather than the daemon's.
+ */
+struct resolved {
+	struct resolved *next;
+	char *key;
+	char *env; size_t envsize;
+	char *words; size_t size, count;
+};
+
+static struct resolved *resolved;
+static pthread_mutex_t resolved_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Everything resolution reads from the environment.
+static const char *const resolve_env[] = { "PATH", "VISUAL", "EDITOR", "TERM", NULL };
+
+/**
+ * @description - Snapshots the variables in resolve_env, so resolutions
+ *   made under different values can be told apart.
+ * @argument size - receives the size of the snapshot
+ * @return - a malloc allocated block, each value NUL terminated after a `=`
+ *   when it's set, so unset and empty differ.
+ */
+static char *resolve_context(size_t *size) {
+	size_t len = 0;
+	for (size_t l=0; resolve_env[l] != NULL; l++) {
+		const char *value = getenv(resolve_env[l]);
+		len += value != NULL ? strlen(value) + 2 : 1;
+	}
+
+	char *env = xmalloc(len), *at = env;
+	for (size_t l=0; resolve_env[l] != NULL; l++) {
+		const char *value = getenv(resolve_env[l]);
+		if (value != NULL) *at++ = '=';
+		at = stpcpy(at, value != NULL ? value : "") + 1;
+	}
+	*size = len;
+	return env;
+}
+
+/**
+ * @description - Appends a previously resolved command to argv.
+ * @argument key - what the command was resolved from
+ * @argument str - receives the buffer backing the new arguments
+ * @argument argv - malloc allocated variadic argument container
+ * @argument argc - a pointer to the count of variadic arguments contain by argv
+ * @return - True when key was resolved before under the same environment,
+ *   false otherwise.
+ */
+static bool recall(const char *key, char **str, char ***argv, size_t *argc) {
+	bool found = false;
+	size_t envsize;
+	char *env = resolve_context(&envsize);
+
+	pthread_mutex_lock(&resolved_lock);
+	for (struct resolved *r = resolved; r != NULL; r = r->next) {
+		if (strcmp(r->key, key) != 0 || r->envsize != envsize
+		|| memcmp(r->env, env, envsize) != 0) continue;
+
+		free(*str);
+		*str = xmemdup(r->words, r->size);
+		char *word = *str;
+		found = true;
+		for (size_t l=0; l < r->count && found; l++) {
+			found = pushvar(&word, argv, argc);
+			word += strlen(word) + 1;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&resolved_lock);
+	free(env);
+	return found;
+}
+
+/**
+ * @description - Remembers the arguments argv[first..argc) resolved from key
+ *   under the current environment. They must all live in one buffer, as the
+ *   sh*accvar helpers leave them.
+ */
+static void remember(const char *key, char **argv, size_t first, size_t argc) {
+	struct resolved *r = xmalloc(sizeof(struct resolved));
+	char *last = argv[argc-1];
+	r->key = xstrdup(key);
+	r->env = resolve_context(&r->envsize);
+	r->size = (size_t) (last - argv[first]) + strlen(last) + 1;
+	r->words = xmemdup(argv[first], r->size);
+	r->count = argc - first;
+
+	pthread_mutex_lock(&resolved_lock);
+	r->next = resolved;
+	resolved = r;
+	pthread_mutex_unlock(&resolved_lock);
+}
+
+void resolve_forget(void) {
+	pthread_mutex_lock(&resolved_lock);
+	while (resolved != NULL) {
+		struct resolved *r = resolved;
+		resolved = r->next;
+		free(r->key);
+		free(r->env);
+		free(r->words);
+		free(r);
+	}
+	pthread_mutex_unlock(&resolved_lock);
+}
+
+/**
+ * @description - Creates the FIFO a multiplexed editor reports its exit on,
+ *   in a private directory of its own.
+ * @argument el - the launch to set `done` for
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int pane_channel(struct editor_launch *el) {
+	const char *tmp = getenv("XDG_RUNTIME_DIR");
+	if (tmp == NULL || *tmp == '\0') tmp = "/tmp";
+
+	char *path = xmalloc(strlen(tmp) + sizeof("/m-vipe.XXXXXX/done"));
+	strcpy(path, tmp);
+	strcat(path, "/m-vipe.XXXXXX");
+	if (mkdtemp(path) == NULL) {
+		free(path);
+		return -1;
+	}
+	strcat(path, "/done");
+	if (mkfifo(path, 0600) != 0) {
+		int err = errno;
+		*strrchr(path, '/') = '\0';
+		rmdir(path);
+		free(path);
+		errno = err;
+		return -1;
+	}
+	el->done = path;
+	return 0;
+}
+
+void release_editor(struct editor_launch *el) {
+	if (el->done != NULL) {
+		unlink(el->done);
+		*strrchr(el->done, '/') = '\0';
+		rmdir(el->done);
+		free(el->done);
+		el->done = NULL;
+	}
+	posix_spawn_file_actions_destroy(&el->fact);
+	free(el->cargv);
+	free(el->window);
+	free(el->editor);
+	el->cargv = NULL;
+	el->window = el->editor = NULL;
+}
+
+/**
+ * @description - Resolves the terminal and editor, then builds the spawn
+ *   arguments and file actions. Runs concurrently with capture so it must
+ *   not exit the program; failures are recorded in the launch status.
+ * @argument arg - the `struct editor_launch` to populate
+ * @return - always NULL, see the launch status for errors.
+ */
+void *resolve_editor(void *arg) {
+	struct editor_launch *el = arg;
+	int l = 0;
+
+	// Preset errno to zero as it's basically a non-error and we can use it
+	// to check for error throws.
+	errno = 0;
+
+	/* NOTE:
+	 *  Struggling to figure out what we need to do to determine the user's preffered
+	 *  Terminal emulator. It seems to be different on every Linux distro. The program
+	 *  targeted by TERM isn't even guaranteed to exist...
+	 *  SOOOOO I'm gonna do a compat move for Debian
+	 *  based distros. Try `$TERM`, then `x-terminal-emulator`. Could also query the
+	 *  display environment like GTK, Gnome, KDE so on and so forth.
+	 *  GTK: gsettings get org.gnome.desktop.default-applications.terminal exec
+	 *       gsettings get org.gnome.desktop.default-applications.terminal exec-arg
+	 */
+	const char *mux = getenv("TMUX") != NULL ? "tmux split-window"
+		: getenv("STY") != NULL ? "screen -X screen" : NULL;
+	if (el->filter) {
+		// Filters don't get a terminal; whatever they print is diagnostics.
+		posix_spawn_file_actions_addopen(&el->fact, 0, "/dev/null", O_RDONLY, (mode_t) 0);
+		posix_spawn_file_actions_adddup2(&el->fact, 2, 1);
+	}
+	else if (el->new_window != 0 && mux != NULL) {
+		/* NOTE:
+		 *  Inside tmux or screen a new pane is far cheaper than a new terminal
+		 *  emulator and works without a display, over SSH for instance. The
+		 *  multiplexer's client returns as soon as the pane is open, so the
+		 *  editor is wrapped to report its exit through a FIFO instead.
+		 */
+		size_t first = el->cargc;
+		if (recall(mux, &el->window, &el->cargv, &el->cargc) != true) {
+			free(el->window);
+			el->window = strdup(mux);
+			if (shexpaccvar(&el->window, &el->cargv, &el->cargc) != true) {
+				el->status = 1; el->error = errno;
+				el->message = "Couldn't reach the terminal multiplexer";
+				return NULL;
+			}
+			remember(mux, el->cargv, first, el->cargc);
+		}
+
+		if (pane_channel(el) != 0) {
+			el->status = 1; el->error = errno;
+			el->message = "Couldn't create a channel to the new pane";
+			return NULL;
+		}
+		// The multiplexer's client has no business with our pipeline.
+		posix_spawn_file_actions_addopen(&el->fact, 0, "/dev/null", O_RDWR, (mode_t) 0);
+		posix_spawn_file_actions_adddup2(&el->fact, 0, 1);
+
+		char *wrapper[] = { "sh", "-c", "\"$@\"; echo $? >\"$0\"", el->done };
+		for (size_t w=0; w < sizeof(wrapper) / sizeof(char*); w++) {
+			if (pushvar(&wrapper[w], &el->cargv, &el->cargc) != true) {
+				el->status = 1; el->error = errno;
+				el->message = "Couldn't rellocate arguments";
+				return NULL;
+			}
+		}
+	}
+	else if (el->new_window != 0 && recall("window", &el->window, &el->cargv, &el->cargc) != true) {
+		char *winopts[2];
+		size_t first = el->cargc;
+		winopts[0] = getenv("TERM");
+		winopts[1] = "x-terminal-emulator";
+		for (l=0; l < 2; l++) {
+			if (winopts[l] == NULL) continue;
+			if (passive_error(el->verbose, el->window) != true) {
+				el->status = 1; el->error = errno;
+				el->message = "Couldn't establish a suitable terminal";
+				return NULL;
+			}
+			errno = 0;
+			free(el->window);
+			el->window = strdup(winopts[l]);
+			if (shexpaccvar(&el->window, &el->cargv, &el->cargc)) break;
+		}
+		if (l == 2) {
+			el->status = 1; el->error = errno;
+			el->message = "Couldn't establish a suitable terminal";
+			return NULL;
+		}
+		remember("window", el->cargv, first, el->cargc);
+	}
+	else if (el->new_window == 0) {
+		// If we're preserving the terminal and not using an alt window, ensure
+		// we actually inherit the TTY. But we don't need this when we're using
+		// a new window.
+		// Open only fd 0 and 1 to TTY, we want to inherit stderr
+		if (el->tty > 0)
+			posix_spawn_file_actions_adddup2(&el->fact, el->tty, 0);
+		else
+			posix_spawn_file_actions_addopen(&el->fact, 0, "/dev/tty", O_RDWR, (mode_t) 0);
+		posix_spawn_file_actions_adddup2(&el->fact, 0, 1);
+	}
+
+	el->editor_at = el->cargc;
+	if (el->argc != 0) {
+		size_t first = el->cargc;
+		// Keyed apart from the defaults, which can't start with '='.
+		char *key = xmalloc(strlen(el->argv[0]) + 2);
+		key[0] = '='; strcpy(key+1, el->argv[0]);
+		bool known = recall(key, &el->editor, &el->cargv, &el->cargc);
+		if (known != true) el->editor = strdup(el->argv[0]);
+		bool found = known || shpaccvar(&el->editor, &el->cargv, &el->cargc);
+		if (known != true) PROBE(resolve__candidate, el->argv[0], (int) found);
+		if (found != true) {
+			free(key);
+			el->status = 127; el->error = errno;
+			el->message = "Editor unavailable";
+			return NULL;
+		}
+		if (known != true) remember(key, el->cargv, first, el->cargc);
+		free(key);
+
+		if (ccvar(&el->cargv, &el->cargc, (char **) el->argv+1, el->argc-1) != true) {
+			el->status = 1; el->error = errno;
+			el->message = "Couldn't rellocate arguments";
+			return NULL;
+		}
+	}
+	else if (recall("editor", &el->editor, &el->cargv, &el->cargc) != true) {
+		char *editopts[5]; l=0;
+		size_t first = el->cargc;
+		// For implementation considerations see:
+		//   https://unix.stackexchange.com/questions/316856
+		editopts[0] = "sensible-editor"; // Try Debian-alikes first
+		editopts[1] = getenv("VISUAL"); // Then in order of user friendlyness
+		editopts[2] = getenv("EDITOR");
+		editopts[3] = "nano";
+		editopts[4] = "vi";
+		bool found = false;
+		do {
+			if (editopts[l] == NULL) continue;
+			if (passive_error(el->verbose, el->editor) != true) {
+				el->status = 1; el->error = errno;
+				el->message = "Couldn't look for an editor";
+				return NULL;
+			}
+			errno = 0;
+			free(el->editor);
+			el->editor = strdup(editopts[l]);
+			found = shexpaccvar(&el->editor, &el->cargv, &el->cargc);
+			PROBE(resolve__candidate, editopts[l], (int) found);
+		}
+		while (found != true && ++l < 5);
+		if (found != true) {
+			el->status = 127; el->error = errno;
+			el->message = "Editor unavailable";
+			return NULL;
+		}
+		remember("editor", el->cargv, first, el->cargc);
+	}
+
+	return NULL;
+}
+
+/**
+ * @description - Swaps the resolved editor, and any arguments it came with,
+ *   for another command. Whatever wraps it, like a new window, stays.
+ * @argument el - a resolved launch
+ * @argument command - the editor to use instead, split and searched like
+ *   VISUAL
+ * @return - zero on success, the launch status otherwise.
+ */
+int replace_editor(struct editor_launch *el, const char *command) {
+	el->cargc = el->editor_at;
+	el->cargv[el->cargc] = NULL;
+	free(el->editor);
+	el->editor = xstrdup(command);
+	bool found = shexpaccvar(&el->editor, &el->cargv, &el->cargc);
+	PROBE(resolve__candidate, (char *) command, (int) found);
+	if (found != true) {
+		el->status = 127; el->error = errno;
+		el->message = "Editor unavailable";
+	}
+	return el->status;
+}
+
+/* NOTE:
+ *  Editors that slow to a crawl on huge files mostly do so in their
+ *  configuration: syntax highlighting, plugins, swap files. These skip it.
+ *  Matched on the whole name, as run or of the real file, so `vi` that's
+ *  really vim.basic counts and nvi, busybox, emacsclient or nvim-qt don't.
+ *  Wrappers like sensible-editor can't be told what they'll run, and are
+ *  left alone.
+ */
+static const struct light {
+	const char *names[7];
+	char *args[3];
+} lights[] = {
+	{ { "nvim" }, { "--clean" } },
+	{ { "vim", "vim.basic", "vim.tiny", "vim.nox", "vim.gtk", "vim.gtk3", "vim.athena" },
+		{ "-u", "NONE", "-N" } },
+	{ { "nano" }, { "--ignorercfiles" } },
+	{ { "emacs", "emacs-nox", "emacs-gtk", "emacs-pgtk", "emacs-lucid" }, { "-Q" } },
+};
+
+static const char *basename_of(const char *path) {
+	return strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+}
+
+static const struct light *find_light(const char *name) {
+	for (size_t l=0; l < sizeof(lights) / sizeof(*lights); l++)
+		for (size_t n=0; n < 7 && lights[l].names[n] != NULL; n++)
+			if (strcmp(name, lights[l].names[n]) == 0) return &lights[l];
+	return NULL;
+}
+
+/**
+ * @description - Makes a resolved editor start without its configuration,
+ *   when it's one of the few we know how to do that for.
+ * @argument el - a resolved launch
+ * @return - zero on success, including for editors we don't know, the
+ *   launch status otherwise.
+ */
+int lighten_editor(struct editor_launch *el) {
+	if (el->editor_at >= el->cargc) return 0;
+
+	const struct light *light = find_light(basename_of(el->cargv[el->editor_at]));
+	if (light == NULL) {
+		char *real = realpath(el->cargv[el->editor_at], NULL);
+		if (real != NULL) light = find_light(basename_of(real));
+		free(real);
+	}
+	if (light == NULL) return 0;
+
+	// Appended, then moved in right behind the program itself.
+	size_t n = 0;
+	while (n < 3 && light->args[n] != NULL) n++;
+	if (ccvar(&el->cargv, &el->cargc, (char **) light->args, n) != true) {
+		el->status = 1; el->error = errno;
+		el->message = "Couldn't rellocate arguments";
+		return el->status;
+	}
+	char **at = el->cargv + el->editor_at + 1;
+	memmove(at + n, at, (el->cargc - n - el->editor_at - 1) * sizeof(char*));
+	memcpy(at, light->args, n * sizeof(char*));
+	return 0;
+}
@@ -0,0 +1,79 @@
+// Minimal epoll event loop, see internal.h for the model.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <errno.h>
+
+// External Includes
+#include <unistd.h>
+#include <sys/epoll.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+int evloop_init(struct evloop *loop) {
+	loop->running = false;
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	return loop->epfd < 0 ? -1 : 0;
+}
+
+/**
+ * @description - Starts watching a source. Will set errno on error; notably
+ *   EPERM when the fd is a regular file or otherwise unpollable, in which case
+ *   the caller should fall back to plain blocking I/O.
+ * @argument loop - the loop to register with
+ * @argument src - the source to register, must outlive its registration
+ * @argument events - epoll event mask to wait for
+ * @return - zero on success, -1 on failure.
+ */
+int evloop_add(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct epoll_event ev = { .events = events, .data.ptr = src };
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, src->fd, &ev) != 0)
+		return -1;
+	src->active = true;
+	return 0;
+}
+
+void evloop_del(struct evloop *loop, struct ev_source *src) {
+	if (src->active != true) return;
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+	src->active = false;
+}
+
+void evloop_stop(struct evloop *loop) {
+	loop->running = false;
+}
+
+/**
+ * @description - Dispatches ready sources until `evloop_stop` is called.
+ * @argument loop - the loop to run
+ * @return - zero when stopped, -1 with errno set if epoll fails.
+ */
+int evloop_run(struct evloop *loop) {
+	struct epoll_event events[8];
+
+	loop->running = true;
+	while (loop->running) {
+		int n = epoll_wait(loop->epfd, events, 8, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		for (int l=0; l < n && loop->running; l++) {
+			struct ev_source *src = events[l].data.ptr;
+			// A callback earlier in this batch may have retired this source.
+			if (src->active != true) continue;
+			src->callback(loop, src, events[l].events);
+		}
+	}
+	return 0;
+}
+
+void evloop_close(struct evloop *loop) {
+	close(loop->epfd);
+}
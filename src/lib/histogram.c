@@ -0,0 +1,246 @@
+// Latency histograms kept across runs in XDG_STATE_HOME.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <error.h>
+#include <stdio.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+/* NOTE:
+ *  One small file holds a histogram per metric, laid out like HdrHistogram:
+ *  values below 2^HIST_SUB_BITS get a bucket each, above that every power
+ *  of two is split into 2^HIST_SUB_BITS equal buckets, so any value is
+ *  known to within about 3% from 0 up to 2^64. The file has a fixed size
+ *  and is only ever updated with atomic adds on a shared mapping, so any
+ *  number of m-vipe processes can record into it at once without locking.
+ *  A reader racing a recorder may see the count, sum and buckets out of
+ *  step with each other. The count is added last with release ordering and
+ *  read first with acquire, so every run it includes already has its
+ *  bucket and sum in place; the sum and buckets may include a run or two
+ *  more, which only nudges the mean.
+ */
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+// Bumped whenever the layout changes; an old file is then left alone.
+#define HIST_MAGIC 0x3147483e4556494dULL // "MIVE>HG1"
+
+enum hist_metric {
+	HIST_CAPTURE, // Capture throughput in bytes per second.
+	HIST_TO_EDITOR, // Session start to editor running, microseconds.
+	HIST_REPLAY, // Editor exit to the last byte out, microseconds.
+	HIST_METRICS
+};
+
+static const struct {
+	const char *name;
+	const char *unit;
+	double scale; // Divides recorded values into `unit`.
+} hist_info[HIST_METRICS] = {
+	[HIST_CAPTURE] = { "capture throughput", "MiB/s", 1024.0 * 1024.0 },
+	[HIST_TO_EDITOR] = { "time to editor", "ms", 1e3 },
+	[HIST_REPLAY] = { "replay latency", "ms", 1e3 },
+};
+
+struct hist {
+	atomic_uint_fast64_t count;
+	atomic_uint_fast64_t sum;
+	atomic_uint_fast64_t buckets[HIST_BUCKETS];
+};
+
+struct hist_file {
+	atomic_uint_fast64_t magic;
+	struct hist hists[HIST_METRICS];
+};
+
+static unsigned hist_index(uint64_t value) {
+	if (value < HIST_SUB) return (unsigned) value;
+	int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	return (unsigned) ((shift + 1) * HIST_SUB + (int) ((value >> shift) - HIST_SUB));
+}
+
+// The largest value that lands in bucket `index`.
+static uint64_t hist_value(unsigned index) {
+	if (index < HIST_SUB) return index;
+	unsigned shift = index / HIST_SUB - 1;
+	uint64_t mantissa = index % HIST_SUB + HIST_SUB;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * @description - Finds the histogram file, creating its directories if asked.
+ * @return - a malloc allocated path, or NULL when there's no home to use.
+ */
+static char *hist_path(bool create) {
+	const char *state = getenv("XDG_STATE_HOME");
+	const char *home = getenv("HOME");
+	const char *base, *rest;
+
+	// The spec's default is relative to HOME, and so is everything we make.
+	if (state != NULL && *state == '/') { base = state; rest = "/m-vipe/histograms"; }
+	else if (home != NULL && *home != '\0') { base = home; rest = "/.local/state/m-vipe/histograms"; }
+	else return NULL;
+
+	char *path = xmalloc(strlen(base) + strlen(rest) + 1);
+	strcpy(path, base);
+	strcat(path, rest);
+
+	// Make any directory missing on the way, base included; the last
+	// component is the file.
+	for (char *slash = path + 1; create && (slash = strchr(slash, '/')) != NULL; slash++) {
+		*slash = '\0';
+		int made = mkdir(path, 0700);
+		*slash = '/';
+		if (made != 0 && errno != EEXIST) {
+			free(path);
+			return NULL;
+		}
+	}
+	return path;
+}
+
+/**
+ * @description - Maps the histogram file, creating it when recording.
+ * @return - the mapping, or NULL with errno set.
+ */
+static struct hist_file *hist_map(bool create) {
+	char *path = hist_path(create);
+	struct stat stat_buf;
+	if (path == NULL) {
+		if (errno == 0) errno = ENOENT;
+		return NULL;
+	}
+
+	int fd = open(path, (create ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0600);
+	free(path);
+	if (fd < 0) return NULL;
+
+	// Extending to the same size twice is harmless, so racing creators are
+	// fine; the new space reads as zeros.
+	struct hist_file *hf = NULL;
+	if (fstat(fd, &stat_buf) == 0 && (stat_buf.st_size >= (off_t) sizeof(*hf)
+			|| (create && ftruncate(fd, sizeof(*hf)) == 0)))
+		hf = mmap(NULL, sizeof(*hf), create ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, fd, 0);
+	else if (errno == 0) errno = EINVAL;
+	close(fd);
+	if (hf == MAP_FAILED || hf == NULL) return NULL;
+
+	uint_fast64_t magic = 0;
+	if (create) atomic_compare_exchange_strong(&hf->magic, &magic, HIST_MAGIC);
+	else magic = atomic_load(&hf->magic);
+	if (magic != 0 && magic != HIST_MAGIC) {
+		munmap(hf, sizeof(*hf));
+		errno = EPROTO;
+		return NULL;
+	}
+	return hf;
+}
+
+static void hist_add(struct hist *h, uint64_t value) {
+	atomic_fetch_add_explicit(&h->buckets[hist_index(value)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_release);
+}
+
+void histogram_record(struct session *s) {
+	const struct stats *st = &s->stats;
+	if (st->record != true || s->status != 0) return;
+
+	struct hist_file *hf = hist_map(true);
+	if (hf == NULL) {
+		if (s->verbose != 0) error(0, errno, "Error: Couldn't record stats");
+		return;
+	}
+
+	const struct phase *capture = &st->phases[PHASE_CAPTURE];
+	if (st->capture.bytes != 0 && capture->wall > 0)
+		hist_add(&hf->hists[HIST_CAPTURE], (uint64_t) ((double) st->capture.bytes / capture->wall));
+	if (st->to_editor > 0)
+		hist_add(&hf->hists[HIST_TO_EDITOR], (uint64_t) (st->to_editor * 1e6));
+	if (st->phases[PHASE_REPLAY].wall > 0)
+		hist_add(&hf->hists[HIST_REPLAY], (uint64_t) (st->phases[PHASE_REPLAY].wall * 1e6));
+	munmap(hf, sizeof(*hf));
+}
+
+int mvipe_stats_report(int outfd) {
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	char *report = NULL;
+	size_t size = 0;
+
+	struct hist_file *hf = hist_map(false);
+	if (hf == NULL) {
+		session_fail(NULL, 1, errno == ENOENT
+			? "Nothing recorded yet, see `--stats-record`" : "Couldn't read recorded stats");
+		return 1;
+	}
+
+	FILE *out = open_memstream(&report, &size);
+	if (out == NULL) {
+		munmap(hf, sizeof(*hf));
+		session_fail(NULL, 1, "Couldn't build the report");
+		return 1;
+	}
+	fprintf(out, "%-20s %8s %10s %10s %10s %10s %10s %10s\n",
+		"metric", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for (int m=0; m < HIST_METRICS; m++) {
+		const struct hist *h = &hf->hists[m];
+		uint64_t count = atomic_load_explicit(&h->count, memory_order_acquire), seen = 0;
+		double scale = hist_info[m].scale;
+		size_t next = 0;
+
+		fprintf(out, "%-20s %8llu", hist_info[m].name, (unsigned long long) count);
+		if (count == 0) {
+			fprintf(out, "\n");
+			continue;
+		}
+		fprintf(out, " %10.3f", (double) atomic_load(&h->sum) / (double) count / scale);
+
+		// Walk the buckets once, printing each percentile as it's passed.
+		uint64_t max = 0;
+		for (unsigned b=0; b < HIST_BUCKETS; b++) {
+			uint64_t n = atomic_load(&h->buckets[b]);
+			if (n == 0) continue;
+			seen += n;
+			max = hist_value(b);
+			for (; next < sizeof(percentiles) / sizeof(double)
+					&& (double) seen >= percentiles[next] / 100.0 * (double) count; next++)
+				fprintf(out, " %10.3f", (double) max / scale);
+		}
+		// Buckets hold at least count runs, so only a damaged file gets here;
+		// keep its columns lined up anyway.
+		for (; next < sizeof(percentiles) / sizeof(double); next++)
+			fprintf(out, " %10.3f", (double) max / scale);
+		fprintf(out, " %10.3f %s\n", (double) max / scale, hist_info[m].unit);
+	}
+	munmap(hf, sizeof(*hf));
+
+	int status = 0;
+	if (fclose(out) != 0 || full_write(outfd, report, size) != size) {
+		session_fail(NULL, 1, "Writing the report");
+		status = 1;
+	}
+	free(report);
+	return status;
+}
@@ -0,0 +1,518 @@
+// Declarations shared between libmvipe's translation units. Nothing in here
+// is part of the public interface; see mvipe.h for that.
+#ifndef MVIPE_INTERNAL_H
+#define MVIPE_INTERNAL_H
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// External Includes
+#include <unistd.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Internal Includes
+#include "mvipe.h"
+#include "probes.h"
+
+
+/**
+ * NOTE: See https://stackoverflow.com/questions/3437404/min-and-max-in-c
+ *   for why this implementation is better and should probably be migrated to
+ *   gnulib.
+ */
+#define max(a,b)           \
+({                         \
+	__typeof__ (a) _a = (a); \
+	__typeof__ (b) _b = (b); \
+	_a > _b ? _a : _b;       \
+})
+#define min(a,b)           \
+({                         \
+	__typeof__ (a) _a = (a); \
+	__typeof__ (b) _b = (b); \
+	_a < _b ? _a : _b;       \
+})
+#undef MAX
+#undef MIN
+#define MAX max
+#define MIN min
+
+// NOTE: how large a space we need to contain the following objects
+//       using binary growth
+//       The top set bit is floor(log2(n)), without needing libm.
+#define BINALLOC(size, count) ( \
+	size * ((1 << (63 - __builtin_clzll((unsigned long long) ((count) * size)))) >> 1) \
+)
+
+
+////////////////////////////////////////////////////////////////////////////////
+// storage.c
+
+// System calls made and bytes moved, for `--stats`.
+struct io_count {
+	uint64_t reads, writes;
+	uint64_t bytes;
+};
+
+size_t cat_blksize(int infd, int outfd);
+int very_simple_cat(int infd, int outfd, struct io_count *count);
+int storage_open(bool volat, FILE **safp);
+char *storage_path(int safd);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// evloop.c
+
+/* NOTE:
+ *  Minimal epoll event loop. Every fd m-vipe waits on (stdin, the editor's
+ *  pidfd, a signalfd, stdout) is registered as an `ev_source`, and its
+ *  callback runs whenever epoll reports it ready. Callbacks must not block
+ *  for long; do one unit of work and return to the loop.
+ */
+struct evloop;
+struct ev_source;
+typedef void ev_callback(struct evloop *loop, struct ev_source *src, uint32_t events);
+
+struct ev_source {
+	int fd;
+	ev_callback *callback;
+	void *data;
+	bool active;
+};
+
+struct evloop {
+	int epfd;
+	bool running;
+};
+
+int evloop_init(struct evloop *loop);
+int evloop_add(struct evloop *loop, struct ev_source *src, uint32_t events);
+void evloop_del(struct evloop *loop, struct ev_source *src);
+void evloop_stop(struct evloop *loop);
+int evloop_run(struct evloop *loop);
+void evloop_close(struct evloop *loop);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// args.c
+
+bool shexpaccvar(char **str, char ***argv, size_t *argc);
+bool shpaccvar(char **str, char ***argv, size_t *argc);
+bool pushvar(char **str, char ***argv, size_t *argc);
+bool ccvar(char ***toargv, size_t *toargc, char **fromargv, size_t fromargc);
+bool passive_error(int verbose, const char* message);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// editor.c
+
+/**
+ * @description - Everything needed to spawn the editor that doesn't depend on
+ *   the contents of the storage area. Filled in by `resolve_editor` on a
+ *   helper thread while stdin is still being captured, so the editor is
+ *   ready to exec the moment capture finishes.
+ */
+struct editor_launch {
+	// Inputs, set before the helper thread is started.
+	int verbose;
+	int new_window;
+	int tty;
+	bool filter; // Run without a terminal; stdin is /dev/null, stdout stderr.
+	int argc;
+	const char **argv;
+
+	// Outputs, only valid after the helper thread is joined.
+	posix_spawn_file_actions_t fact;
+	char **cargv; size_t cargc;
+	size_t editor_at; // Where the editor's own words start in cargv.
+	char *window;
+	char *editor;
+	char *done; // FIFO a multiplexer pane reports the editor's exit on.
+	int status; // Exit status to report failure with; zero on success.
+	int error; // errno at the time of failure.
+	const char *message;
+};
+
+void *resolve_editor(void *arg);
+void release_editor(struct editor_launch *el);
+int replace_editor(struct editor_launch *el, const char *command);
+int lighten_editor(struct editor_launch *el);
+// Drops every remembered resolution, so the next one searches PATH again.
+void resolve_forget(void);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// msgpack.c
+
+// Growable encode buffer; zero initialize, free data when done.
+struct mp_buf {
+	char *data;
+	size_t size, cap;
+};
+
+void mp_array(struct mp_buf *b, size_t n);
+void mp_map(struct mp_buf *b, size_t n);
+void mp_nil(struct mp_buf *b);
+void mp_bool(struct mp_buf *b, bool v);
+void mp_int(struct mp_buf *b, int64_t v);
+void mp_str(struct mp_buf *b, const char *s, size_t n);
+void mp_cstr(struct mp_buf *b, const char *s);
+void mp_ext_int(struct mp_buf *b, int8_t type, int64_t v);
+
+enum mp_type { MP_NIL, MP_BOOL, MP_INT, MP_FLOAT, MP_STR, MP_ARRAY, MP_MAP, MP_EXT };
+
+/**
+ * @description - A decoded value. Strings (and binary, which is treated the
+ *   same) point into the decoded buffer. Maps hold keys and values
+ *   alternately in items, so n is twice the number of pairs.
+ */
+struct mp_value {
+	enum mp_type type;
+	bool b;
+	int64_t i; // MP_INT, or the handle of an MP_EXT.
+	int8_t ext;
+	const char *s;
+	struct mp_value *items;
+	size_t n;
+};
+
+/**
+ * @description - Decodes the value at the start of data.
+ * @return - bytes consumed, 0 when data ends mid-value, -1 when malformed.
+ */
+ssize_t mp_decode(const char *data, size_t size, struct mp_value *v);
+
+// Nothing Neovim sends back to us nests anywhere near this deep.
+#define MP_MAX_DEPTH 32
+
+// How far mp_measure got into a value; zero initialize.
+struct mp_scan {
+	size_t at;
+	size_t depth;
+	uint64_t left[MP_MAX_DEPTH]; // Items still to come in each open container.
+};
+
+/**
+ * @description - Finds where the value at the start of data ends, without
+ *   decoding or allocating anything. Picks up where the last call on the
+ *   same value left off, so data may grow between calls but not move
+ *   relative to the value's start.
+ * @return - the value's length once it's all there, resetting sc; 0 when
+ *   data ends mid-value; -1 when malformed.
+ */
+ssize_t mp_measure(struct mp_scan *sc, const char *data, size_t size);
+void mp_free(struct mp_value *v);
+const struct mp_value *mp_lookup(const struct mp_value *map, const char *key);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// nvim.c
+
+// Connection to a running Neovim that edits in place of a spawned editor.
+struct nvim {
+	struct ev_source src;
+	uint32_t msgid;
+	int64_t channel;
+	int64_t buffer;
+	struct mp_buf in; // Received but not yet decoded.
+	struct mp_scan scan; // How much of the next message has arrived.
+	bool closed; // The buffer closed while a request was still pending.
+};
+
+struct session;
+
+void session_nvim(struct session *s);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// content.c
+
+/**
+ * @description - What capture saw of the input, to pick an editor that can
+ *   cope with it. Only what `lines` and `text` ask for is counted.
+ */
+struct content {
+	bool lines; // Count lines and the longest one, in bytes.
+	bool text; // Count NULs and check for UTF-8.
+	uint64_t nlines, longest, nuls;
+	bool invalid; // Not UTF-8.
+
+	// Carried from one block to the next.
+	uint64_t line; // Length of the unfinished last line so far.
+	unsigned need; // UTF-8 continuation bytes still expected,
+	unsigned char lo, hi; // and the range the next one has to be in.
+};
+
+void content_scan(struct content *c, const char *buf, size_t len);
+void content_end(struct content *c);
+bool content_binary(const struct content *c);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// progress.c
+
+/**
+ * @description - The `--progress` meter. Between begin and end it shows
+ *   whatever `bytes` points at, against `total` when that's known.
+ */
+struct progress {
+	struct ev_source tick; // Redraws on a timer, so has to come first.
+	int fd; // Where to draw, or -1 when off.
+	bool owned;
+	const char *phase;
+	const uint64_t *bytes;
+	uint64_t total;
+	long long start, next; // CLOCK_MONOTONIC_COARSE nanoseconds.
+	bool drawn;
+};
+
+void progress_init(struct progress *p);
+int progress_open(struct progress *p);
+void progress_begin(struct progress *p, struct evloop *loop, const char *phase,
+	const uint64_t *bytes, uint64_t total);
+void progress_update(struct progress *p);
+void progress_end(struct progress *p, struct evloop *loop);
+void progress_close(struct progress *p);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ttylock.c
+
+// Place in the queue for a terminal shared with other m-vipe processes.
+struct ttylock {
+	int fd; // The queue file, or -1 when there's no terminal to share.
+	char *path;
+	bool queued;
+};
+
+int ttylock_open(struct ttylock *t, int tty);
+int ttylock_join(struct ttylock *t);
+int ttylock_poll(struct ttylock *t);
+void ttylock_close(struct ttylock *t);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// shard.c
+
+/**
+ * @description - One slice of the storage area in `--parallel` mode, with
+ *   the editor filtering it.
+ */
+struct shard {
+	int fd;
+	char *path; // In the session's sharddir.
+	pid_t pid; // The editor while it runs, -1 otherwise.
+};
+
+void session_shard(struct session *s);
+void session_reap_shards(struct session *s);
+void session_drop_shards(struct session *s);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// stats.c
+
+enum stats_phase {
+	PHASE_CAPTURE,
+	PHASE_RESOLVE,
+	PHASE_SPAWN,
+	PHASE_EDIT,
+	PHASE_REPLAY,
+	PHASES
+};
+
+/**
+ * @description - Time and faults spent in one phase, summed over every time
+ *   it ran. `who` is RUSAGE_THREAD for work done on a helper thread.
+ */
+struct phase {
+	bool running;
+	int who;
+	struct timespec wall0;
+	struct rusage ru0;
+	double wall, user, sys; // Seconds.
+	long minflt, majflt;
+};
+
+struct stats {
+	bool enabled; // Collecting, for either of the two below.
+	bool print; // Report on fd at the end.
+	bool record; // Add to the histograms at the end.
+	bool json;
+	int fd;
+	struct timespec start;
+	double to_editor; // Seconds from start until the first edit began.
+	struct phase phases[PHASES];
+	struct io_count capture;
+};
+
+void stats_begin(struct stats *st, enum stats_phase p);
+void stats_end(struct stats *st, enum stats_phase p);
+void stats_report(struct session *s);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// histogram.c
+
+void histogram_record(struct session *s);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// replay.c
+
+/* NOTE:
+ *  Ways of moving the storage area to an output. `rw` is the portable
+ *  read/write loop, the rest avoid copying through userspace but need the
+ *  output to be a pipe (splice, vmsplice), a regular file (copy) or a recent
+ *  kernel (sendfile to a pipe is 5.12+). Any backend the kernel refuses drops
+ *  back to `rw` mid-replay.
+ */
+enum replay_backend {
+	REPLAY_AUTO,
+	REPLAY_RW,
+	REPLAY_SENDFILE,
+	REPLAY_SPLICE,
+	REPLAY_VMSPLICE,
+	REPLAY_COPY,
+};
+
+extern const char *const replay_backends[];
+
+/**
+ * @description - One destination of the replay; stdout and every `--tee`.
+ *   Each sink walks the storage area at its own pace, so a slow consumer on
+ *   one doesn't hold back the others.
+ */
+struct sink {
+	struct ev_source src;
+	const char *name;
+	enum replay_backend backend;
+	bool piped;
+	bool owned; // Opened by us, closed when the session ends.
+
+	// `pending` bytes of the storage area ending at offset `replayed` sit in
+	// buf, of which `sent` have been written.
+	off_t replayed;
+	size_t pending, sent;
+	char *buf;
+	bool last; // buf runs to the end of storage, no need to read again.
+
+	int outflags; // File status flags before replay, or -1.
+	bool done;
+	struct io_count io;
+};
+
+int parse_replay_backend(const char *name, enum replay_backend *backend);
+void session_replay(struct session *s);
+void session_emit(struct session *s, bool final);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// session.c
+
+#define SMALL_INPUT 4096
+
+/**
+ * @description - State for one capture, edit, replay cycle driven by the
+ *   event loop. Each phase registers the sources it needs and retires them
+ *   when done; signals are watched for the whole session.
+ */
+struct session {
+	struct evloop loop;
+	int verbose;
+	bool volat;
+	int safd;
+	FILE *safp;
+	struct editor_launch launch;
+	pthread_t resolver;
+	bool resolving;
+	sigset_t sigmask; // Mask to restore in the editor and after the session.
+
+	char *buf; size_t bufsize;
+
+	// Most input is a few lines. Until it outgrows `small` capture keeps it
+	// here and writes the storage area once at EOF; replay reads results that
+	// fit back into it with a single pread, so neither needs buf.
+	char small[SMALL_INPUT]; size_t nsmall;
+	bool escalated; // Input didn't fit, capture went on through buf.
+	bool replay_small;
+
+	// Names of the storage areas to edit, as the editor should open them.
+	// Batches go to as many editors as ARG_MAX needs, one after the other.
+	char **paths; size_t npaths;
+	size_t spawned; // Paths handed to an editor so far.
+
+	// With more than one, a single storage area is split on record
+	// boundaries and the editor runs as a filter on every shard at once.
+	unsigned parallel;
+	struct shard *shards; size_t nshards;
+	char *sharddir; // Private directory holding the shards.
+	size_t running; // Shards whose editor hasn't exited yet.
+
+	// sinks[0] is the primary output, the rest come from `--tee`. A session
+	// without sinks edits the storage area in place and stops there.
+	struct sink *sinks; size_t nsinks;
+	size_t live; // Sinks still being written.
+	enum replay_backend backend;
+	char *map; size_t mapsize; // Storage mapping for vmsplice.
+
+	// With emit_on_save every save goes out while the editor is still open:
+	// only what was appended, when the first `emitted` bytes still hash to
+	// `emithash`, or the whole storage area again otherwise. Replay then
+	// starts from `replay_from` instead of the beginning.
+	bool emit_on_save;
+	off_t emitted, replay_from;
+	uint64_t emithash;
+	bool polling; // Saves are watched for by polling these.
+	struct timespec seen_mtime; off_t seen_size;
+
+	// When set, storage already written to every sink is punched out up to
+	// `released`, so memory use shrinks as a slow consumer catches up.
+	bool release;
+	off_t released;
+
+	struct ev_source input;
+	struct ev_source signals;
+	struct ev_source editor;
+	struct ev_source pane;
+	struct ev_source saves; // inotify, or a timerfd where that can't watch.
+
+	// Turn on the terminal. While queued the queue file is watched, with a
+	// timer as backup for holders that die without updating it.
+	struct ttylock ttylock;
+	bool ttyheld;
+	struct ev_source ttywatch;
+	struct ev_source ttytick;
+
+	pid_t child;
+	const char *server; // Edit in this Neovim instead of spawning an editor.
+	struct nvim nvim;
+
+	struct stats stats;
+	struct progress progress;
+
+	// Limits from mvipe_options, checked against what capture saw before
+	// the first spawn; zero means no limit.
+	struct content content;
+	uint64_t large_size, large_lines, large_line;
+	const char *large_editor, *binary_editor;
+	bool adapted;
+
+	// First failure, reported by the public entry point once the loop stops.
+	int status;
+	int error;
+};
+
+void session_fail(struct session *s, int status, const char *format, ...);
+char *session_buf(struct session *s);
+void session_spawn(struct session *s);
+void session_edited(struct session *s);
+
+#endif /* MVIPE_INTERNAL_H */
@@ -0,0 +1,281 @@
+// Just enough MessagePack to talk to Neovim's RPC API.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// External Includes
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+static void mp_put(struct mp_buf *b, const void *data, size_t size) {
+	if (b->size + size > b->cap) {
+		b->cap = MAX(b->size + size, 2 * b->cap);
+		b->data = xrealloc(b->data, b->cap);
+	}
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+}
+
+// Writes a type byte followed by a big endian value of `width` bytes.
+static void mp_put_be(struct mp_buf *b, uint8_t type, uint64_t value, int width) {
+	unsigned char out[9];
+	out[0] = type;
+	for (int l=0; l < width; l++)
+		out[1+l] = (unsigned char) (value >> (8 * (width - 1 - l)));
+	mp_put(b, out, 1 + width);
+}
+
+// Containers and strings share the same fix/16/32 bit layout.
+static void mp_put_len(struct mp_buf *b, uint8_t fix, size_t fixmax, uint8_t t16, size_t n) {
+	if (n <= fixmax) mp_put_be(b, fix | (uint8_t) n, 0, 0);
+	else if (n <= UINT16_MAX) mp_put_be(b, t16, n, 2);
+	else mp_put_be(b, t16 + 1, n, 4);
+}
+
+void mp_array(struct mp_buf *b, size_t n) { mp_put_len(b, 0x90, 15, 0xdc, n); }
+void mp_map(struct mp_buf *b, size_t n) { mp_put_len(b, 0x80, 15, 0xde, n); }
+void mp_nil(struct mp_buf *b) { mp_put_be(b, 0xc0, 0, 0); }
+void mp_bool(struct mp_buf *b, bool v) { mp_put_be(b, v ? 0xc3 : 0xc2, 0, 0); }
+
+void mp_int(struct mp_buf *b, int64_t v) {
+	if (v >= 0 && v <= 127) mp_put_be(b, (uint8_t) v, 0, 0);
+	else if (v < 0 && v >= -32) mp_put_be(b, (uint8_t) v, 0, 0);
+	else if (v >= INT32_MIN && v <= INT32_MAX) mp_put_be(b, 0xd2, (uint32_t) v, 4);
+	else mp_put_be(b, 0xd3, (uint64_t) v, 8);
+}
+
+void mp_str(struct mp_buf *b, const char *s, size_t n) {
+	if (n <= 31) mp_put_be(b, 0xa0 | (uint8_t) n, 0, 0);
+	else if (n <= UINT8_MAX) mp_put_be(b, 0xd9, n, 1);
+	else if (n <= UINT16_MAX) mp_put_be(b, 0xda, n, 2);
+	else mp_put_be(b, 0xdb, n, 4);
+	mp_put(b, s, n);
+}
+
+void mp_cstr(struct mp_buf *b, const char *s) { mp_str(b, s, strlen(s)); }
+
+void mp_ext_int(struct mp_buf *b, int8_t type, int64_t v) {
+	struct mp_buf payload = { 0 };
+	mp_int(&payload, v);
+	// Only a positive fixint fits fixext 1, anything else takes ext 8.
+	if (payload.size == 1) mp_put_be(b, 0xd4, 0, 0);
+	else mp_put_be(b, 0xc7, payload.size, 1);
+	mp_put(b, &type, 1);
+	mp_put(b, payload.data, payload.size);
+	free(payload.data);
+}
+
+
+static uint64_t mp_get_be(const unsigned char *p, int width) {
+	uint64_t v = 0;
+	for (int l=0; l < width; l++) v = (v << 8) | p[l];
+	return v;
+}
+
+/**
+ * @description - Decodes one value starting at *p, advancing *p past it.
+ *   Strings point into the input rather than being copied.
+ * @return - 1 on success, 0 when the input ends early, -1 when malformed.
+ */
+static int mp_decode_at(const unsigned char **p, const unsigned char *end,
+		struct mp_value *v, int depth) {
+	#define NEED(n) do { if ((size_t) (end - *p) < (size_t) (n)) return 0; } while (0)
+	size_t n = 0, width = 0;
+	int status;
+
+	if (depth > MP_MAX_DEPTH) return -1;
+	NEED(1);
+	unsigned char t = *(*p)++;
+	memset(v, 0, sizeof(*v));
+
+	if (t <= 0x7f) { v->type = MP_INT; v->i = t; return 1; }
+	if (t >= 0xe0) { v->type = MP_INT; v->i = (int8_t) t; return 1; }
+	if ((t & 0xf0) == 0x80) { v->type = MP_MAP; n = t & 0x0f; goto items; }
+	if ((t & 0xf0) == 0x90) { v->type = MP_ARRAY; n = t & 0x0f; goto items; }
+	if ((t & 0xe0) == 0xa0) { v->type = MP_STR; n = t & 0x1f; goto bytes; }
+
+	switch (t) {
+		case 0xc0: v->type = MP_NIL; return 1;
+		case 0xc2: case 0xc3: v->type = MP_BOOL; v->b = t == 0xc3; return 1;
+
+		case 0xcc: case 0xcd: case 0xce: case 0xcf:
+			width = (size_t) 1 << (t - 0xcc);
+			NEED(width);
+			v->type = MP_INT; v->i = (int64_t) mp_get_be(*p, (int) width);
+			*p += width;
+			return 1;
+		case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+			width = (size_t) 1 << (t - 0xd0);
+			NEED(width);
+			v->type = MP_INT;
+			// Sign extend from the top bit of the encoded width.
+			v->i = (int64_t) (mp_get_be(*p, (int) width) << (64 - 8*width)) >> (64 - 8*width);
+			*p += width;
+			return 1;
+		case 0xca: NEED(4); *p += 4; v->type = MP_FLOAT; return 1;
+		case 0xcb: NEED(8); *p += 8; v->type = MP_FLOAT; return 1;
+
+		case 0xd9: case 0xda: case 0xdb: case 0xc4: case 0xc5: case 0xc6:
+			width = (size_t) 1 << ((t >= 0xd9 ? t - 0xd9 : t - 0xc4));
+			NEED(width);
+			n = (size_t) mp_get_be(*p, (int) width);
+			*p += width;
+			v->type = MP_STR;
+			goto bytes;
+
+		case 0xdc: case 0xdd: case 0xde: case 0xdf:
+			width = t & 1 ? 4 : 2;
+			NEED(width);
+			n = (size_t) mp_get_be(*p, (int) width);
+			*p += width;
+			v->type = t < 0xde ? MP_ARRAY : MP_MAP;
+			goto items;
+
+		case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+			n = (size_t) 1 << (t - 0xd4);
+			goto ext;
+		case 0xc7: case 0xc8: case 0xc9:
+			width = (size_t) 1 << (t - 0xc7);
+			NEED(width);
+			n = (size_t) mp_get_be(*p, (int) width);
+			*p += width;
+			goto ext;
+	}
+	return -1;
+
+	bytes:
+	NEED(n);
+	v->s = (const char *) *p;
+	v->n = n;
+	*p += n;
+	return 1;
+
+	ext:
+	// Neovim's extension types (Buffer, Window, Tabpage) wrap an integer.
+	NEED(n + 1);
+	v->type = MP_EXT;
+	v->ext = (int8_t) *(*p)++;
+	{
+		const unsigned char *q = *p;
+		struct mp_value inner;
+		if (mp_decode_at(&q, *p + n, &inner, depth + 1) == 1 && inner.type == MP_INT)
+			v->i = inner.i;
+	}
+	*p += n;
+	return 1;
+
+	items:
+	// Every item takes at least a byte, so this also bounds the allocation.
+	if (v->type == MP_MAP) {
+		if (n > SIZE_MAX / 2) return -1;
+		n *= 2;
+	}
+	if (n > (size_t) (end - *p)) return 0;
+	v->items = n != 0 ? xcalloc(n, sizeof(struct mp_value)) : NULL;
+	v->n = n;
+	for (size_t l=0; l < n; l++) {
+		if ((status = mp_decode_at(p, end, &v->items[l], depth + 1)) != 1) {
+			mp_free(v);
+			return status;
+		}
+	}
+	return 1;
+	#undef NEED
+}
+
+ssize_t mp_decode(const char *data, size_t size, struct mp_value *v) {
+	const unsigned char *p = (const unsigned char *) data;
+	int status = mp_decode_at(&p, p + size, v, 0);
+	if (status != 1) return status;
+	return (ssize_t) (p - (const unsigned char *) data);
+}
+
+/**
+ * @description - Reads the header of the value at p: how long it is, and
+ *   how long its payload is or how many items follow it.
+ * @return - 1 on success, 0 when the header is cut off, -1 when malformed.
+ */
+static int mp_header(const unsigned char *p, size_t avail, size_t *head,
+		uint64_t *payload, uint64_t *items) {
+	size_t width = 0;
+	unsigned char t = *p;
+	*head = 1; *payload = *items = 0;
+
+	if (t <= 0x7f || t >= 0xe0 || t == 0xc0 || t == 0xc2 || t == 0xc3) return 1;
+	if ((t & 0xf0) == 0x80) { *items = 2 * (uint64_t) (t & 0x0f); return 1; }
+	if ((t & 0xf0) == 0x90) { *items = t & 0x0f; return 1; }
+	if ((t & 0xe0) == 0xa0) { *payload = t & 0x1f; return 1; }
+	if (t >= 0xd4 && t <= 0xd8) { *payload = ((uint64_t) 1 << (t - 0xd4)) + 1; return 1; }
+
+	if (t >= 0xcc && t <= 0xcf) { *head += (size_t) 1 << (t - 0xcc); return 1; }
+	if (t >= 0xd0 && t <= 0xd3) { *head += (size_t) 1 << (t - 0xd0); return 1; }
+	if (t == 0xca || t == 0xcb) { *head += t == 0xca ? 4 : 8; return 1; }
+
+	if (t >= 0xd9 && t <= 0xdb) width = (size_t) 1 << (t - 0xd9);
+	else if (t >= 0xc4 && t <= 0xc6) width = (size_t) 1 << (t - 0xc4);
+	else if (t >= 0xc7 && t <= 0xc9) width = (size_t) 1 << (t - 0xc7);
+	else if (t >= 0xdc && t <= 0xdf) width = t & 1 ? 4 : 2;
+	else return -1;
+	if (avail < 1 + width) return 0;
+	*head += width;
+
+	uint64_t n = mp_get_be(p + 1, (int) width);
+	if (t >= 0xdc) *items = t < 0xde ? n : 2 * n;
+	else *payload = t >= 0xc7 && t <= 0xc9 ? n + 1 : n;
+	return 1;
+}
+
+ssize_t mp_measure(struct mp_scan *sc, const char *data, size_t size) {
+	const unsigned char *p = (const unsigned char *) data;
+
+	while (true) {
+		while (sc->depth > 0 && sc->left[sc->depth - 1] == 0) sc->depth--;
+		if (sc->depth == 0 && sc->at != 0) {
+			ssize_t len = (ssize_t) sc->at;
+			memset(sc, 0, sizeof(*sc));
+			return len;
+		}
+		if (sc->at >= size) return 0;
+
+		size_t head;
+		uint64_t payload, items;
+		int status = mp_header(p + sc->at, size - sc->at, &head, &payload, &items);
+		if (status != 1) return status;
+		if (head > size - sc->at || payload > size - sc->at - head) return 0;
+		sc->at += head + (size_t) payload;
+
+		if (sc->depth > 0) sc->left[sc->depth - 1]--;
+		if (items != 0) {
+			if (sc->depth >= MP_MAX_DEPTH) return -1;
+			sc->left[sc->depth++] = items;
+		}
+	}
+}
+
+void mp_free(struct mp_value *v) {
+	if (v->type == MP_ARRAY || v->type == MP_MAP) {
+		for (size_t l=0; l < v->n; l++) mp_free(&v->items[l]);
+		free(v->items);
+	}
+	v->items = NULL;
+	v->n = 0;
+}
+
+const struct mp_value *mp_lookup(const struct mp_value *map, const char *key) {
+	if (map->type != MP_MAP) return NULL;
+	for (size_t l=0; l+1 < map->n; l += 2) {
+		const struct mp_value *k = &map->items[l];
+		if (k->type == MP_STR && k->n == strlen(key) && memcmp(k->s, key, k->n) == 0)
+			return &map->items[l+1];
+	}
+	return NULL;
+}
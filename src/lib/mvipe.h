@@ -0,0 +1,198 @@
+// libmvipe: let a human edit a buffer, file descriptor or stream with their
+// text editor of choice. This is the engine behind the `m-vipe` command.
+#ifndef MVIPE_H
+#define MVIPE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @description - Settings shared by every entry point. Zero initialize and
+ *   fill in what you need; the defaults match running `m-vipe` bare.
+ */
+struct mvipe_options {
+	int verbose; // Report recoverable errors to stderr.
+	int volat; // Keep the storage area in RAM (memfd) instead of a tmpfile.
+	int new_window; // Launch the editor from a new terminal window.
+	int tty; // Terminal to run the editor on. Zero opens /dev/tty.
+	int release; // Free storage as it's written out. See `mvipe_run`.
+	const char *replay; // auto, rw, sendfile, splice, vmsplice or copy.
+
+	// Neovim RPC socket to edit in instead of spawning an editor. When unset,
+	// argc is zero and new_window is off, $NVIM or $NVIM_LISTEN_ADDRESS is
+	// used if either is set (as it is in a Neovim :terminal).
+	const char *server;
+
+	// Treat the editor as a non-interactive filter (`sed -i`, a formatter)
+	// and run this many at once, each on a slice of the input split at
+	// newlines or NULs. The results are put back together in order. Zero
+	// or one runs a single interactive editor; only single inputs are split.
+	unsigned parallel;
+
+	// Write every save to the outputs while the editor is still open, so
+	// downstream can start early: only what was added when the save just
+	// appended, the whole contents again otherwise. Exiting emits the last
+	// change the same way. Only applies to `mvipe_run` with one input.
+	int emit_on_save;
+
+	// Report where the time went when the session ends: "human" or "json",
+	// written to stats_fd (zero means stderr). NULL reports nothing.
+	const char *stats; int stats_fd;
+
+	// Add capture throughput, time to editor and replay latency to the
+	// histograms in $XDG_STATE_HOME/m-vipe, shared by every run that asks;
+	// see `mvipe_stats_report`. Only successful sessions are recorded.
+	int stats_record;
+
+	// Draw bytes, rate, elapsed time and, when the size is known, an ETA
+	// during capture and replay: on stderr if it's a terminal, /dev/tty
+	// otherwise. Runs shorter than half a second draw nothing.
+	int progress;
+
+	// Captured input at or over any of these is large, zero means no limit:
+	// bytes in all, lines, and bytes in the longest line. Large input goes
+	// to large_editor when set. Otherwise editors known to crawl on huge
+	// files because of their configuration start without it: vim -u NONE -N,
+	// nvim --clean, nano --ignorercfiles and emacs -Q.
+	unsigned long long large_size, large_lines, large_line;
+	const char *large_editor;
+
+	// Editor for captured input with NUL bytes or that isn't UTF-8, like
+	// `hexedit`. Takes precedence over large_editor.
+	const char *binary_editor;
+
+	// Extra destinations for `mvipe_run`, opened with O_TRUNC.
+	const char *const *tees; size_t ntees;
+
+	// Editor command followed by its arguments. When argc is zero the first
+	// available of sensible-editor, VISUAL, EDITOR, nano and vi is used.
+	int argc; const char **argv;
+};
+
+/**
+ * @description - Edited contents handed back by `mvipe_edit_buffer`. The data
+ *   is a mapping of the storage area, release it with `mvipe_buffer_free`.
+ */
+struct mvipe_buffer {
+	void *data;
+	size_t size;
+};
+
+/* NOTE:
+ *  Every entry point returns zero on success. On failure it returns the exit
+ *  status `m-vipe` would use (127 when no editor could be found, 1 otherwise),
+ *  sets errno (zero when there's no underlying system error) and leaves a
+ *  description for `mvipe_strerror`.
+ *
+ *  While a call is in progress SIGCHLD, SIGWINCH, SIGTSTP, SIGTTIN, SIGTTOU
+ *  and SIGCONT are blocked in the calling thread and consumed by the call, so
+ *  the editor behaves under job control. The previous mask is restored
+ *  before returning. The editor takes over the controlling terminal.
+ */
+
+/**
+ * @description - Captures infd, lets the user edit it, then writes the
+ *   result to outfd and every tee. This is the whole `m-vipe` pipeline.
+ * @argument opts - settings, or NULL for the defaults
+ * @argument infd - where to read the original contents from
+ * @argument outfd - where to write the edited contents to
+ * @return - zero on success, an exit status otherwise.
+ */
+int mvipe_run(const struct mvipe_options *opts, int infd, int outfd);
+
+/**
+ * @description - Lets the user edit an in-memory buffer. The buffer is written
+ *   straight into the storage area and the result is mapped back out, so
+ *   nothing passes through pipes.
+ * @argument opts - settings, or NULL for the defaults
+ * @argument data - original contents
+ * @argument size - length of data in bytes
+ * @argument out - receives the edited contents; empty when the user deleted
+ *   everything
+ * @return - zero on success, an exit status otherwise.
+ */
+int mvipe_edit_buffer(const struct mvipe_options *opts,
+	const void *data, size_t size, struct mvipe_buffer *out);
+
+/**
+ * @description - Lets the user edit the file behind fd in place, without
+ *   copying it anywhere. fd must be seekable (a regular file or memfd) and
+ *   reopenable through /proc/self/fd.
+ * @argument opts - settings, or NULL for the defaults
+ * @argument fd - descriptor of the contents to edit
+ * @return - zero on success, an exit status otherwise.
+ */
+int mvipe_edit_fd(const struct mvipe_options *opts, int fd);
+
+/**
+ * @description - Like `mvipe_edit_fd` for many fds at once. They're all given
+ *   to one editor, or to as few consecutive editors as ARG_MAX allows.
+ * @argument opts - settings, or NULL for the defaults
+ * @argument fds - descriptors of the contents to edit
+ * @argument count - number of fds
+ * @return - zero on success, an exit status otherwise.
+ */
+int mvipe_edit_fds(const struct mvipe_options *opts, const int *fds, size_t count);
+
+/**
+ * @description - Runs the editor over fd as a non-interactive filter, the
+ *   way `--parallel` does for each shard: no terminal, stdin on /dev/null
+ *   and stdout on stderr. Unlike the other entry points it leaves signals
+ *   alone, so it may be called from several threads at once.
+ * @argument opts - settings, or NULL for the defaults
+ * @argument fd - the file to filter, which the editor opens by name
+ * @return - zero when the editor exited with zero, an exit status otherwise.
+ */
+int mvipe_filter_fd(const struct mvipe_options *opts, int fd);
+
+/**
+ * @description - Like `mvipe_filter_fd` for a file named by path. Filters
+ *   that replace the file by renaming a copy beside it, like `sed -i` or
+ *   `perl -i`, need this: there's nowhere beside /proc/PID/fd/N to put one.
+ * @argument opts - settings, or NULL for the defaults
+ * @argument path - the file to filter
+ * @return - zero when the editor exited with zero, an exit status otherwise.
+ */
+int mvipe_filter_path(const struct mvipe_options *opts, const char *path);
+
+/**
+ * @description - Creates an empty storage area like the one `mvipe_run`
+ *   captures into: a memfd with volat, otherwise an unlinked temporary file.
+ * @argument opts - settings, or NULL for the defaults
+ * @return - a descriptor the caller closes, or -1 with errno set.
+ */
+int mvipe_storage_open(const struct mvipe_options *opts);
+
+/**
+ * @description - Resolves the editor (and terminal, with new_window) ahead of
+ *   time. Resolutions are remembered for the life of the process and by its
+ *   forks, so later calls skip the PATH search. They're kept per PATH,
+ *   VISUAL, EDITOR and TERM, so changing those resolves again.
+ * @argument opts - settings, or NULL for the defaults
+ * @return - zero on success, an exit status otherwise.
+ */
+int mvipe_prepare(const struct mvipe_options *opts);
+
+void mvipe_buffer_free(struct mvipe_buffer *buf);
+
+/**
+ * @description - Prints percentiles of everything `stats_record` has recorded.
+ * @argument outfd - where the table goes
+ * @return - zero on success, 1 when nothing could be read or written.
+ */
+int mvipe_stats_report(int outfd);
+
+/**
+ * @description - Describes the most recent failure in the calling thread.
+ * @return - a message owned by the library, valid until the next call.
+ */
+const char *mvipe_strerror(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MVIPE_H */
@@ -0,0 +1,422 @@
+// Editing in an already running Neovim over its msgpack-RPC socket.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+// External Includes
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <gnulib/safe-read.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+/* NOTE:
+ *  The storage area is loaded into a fresh buffer with nvim_buf_set_lines,
+ *  NVIM_BATCH lines per request so neither side has to hold one enormous
+ *  message. Autocommands on that buffer notify us: every write sends the
+ *  buffer's lines back (the buffer's `acwrite`, so nothing touches disk) and
+ *  hiding or unloading it counts as closing the editor. A buffer that was
+ *  never written leaves the storage area as it was, like quitting vim
+ *  without saving would.
+ *
+ *  Neovim represents NUL bytes as newlines inside a line; both directions
+ *  translate so binary input survives the round trip.
+ */
+#define NVIM_BATCH 4096
+
+enum { RPC_REQUEST = 0, RPC_RESPONSE = 1, RPC_NOTIFICATION = 2 };
+
+// Lines (and their newlines) written back per pwritev.
+#define NVIM_IOV 1024
+
+static void nvim_begin(struct mp_buf *b, struct nvim *n, const char *method, size_t nparams) {
+	mp_array(b, 4);
+	mp_int(b, RPC_REQUEST);
+	mp_int(b, ++n->msgid);
+	mp_cstr(b, method);
+	mp_array(b, nparams);
+}
+
+/**
+ * @description - Appends a line as a msgpack string, turning NUL bytes into
+ *   the newlines Neovim uses for them.
+ */
+static void nvim_line(struct mp_buf *b, const char *line, size_t size) {
+	mp_str(b, line, size);
+	for (char *c = b->data + b->size - size; (c = memchr(c, '\0', b->data + b->size - c)) != NULL; )
+		*c++ = '\n';
+}
+
+/**
+ * @description - Replaces the storage area with lines sent back by Neovim.
+ *   The lines are translated in place, they live in the receive buffer.
+ * @argument s - the session to write to
+ * @argument lines - array of strings
+ * @argument newline - whether the last line ends with a newline
+ */
+static void nvim_store(struct session *s, const struct mp_value *lines, bool newline) {
+	static char nl = '\n';
+	struct iovec iov[NVIM_IOV];
+	int niov = 0;
+	off_t offset = 0;
+
+	if (ftruncate(s->safd, 0) != 0) {
+		session_fail(s, 1, "Writing edited contents to storage area");
+		return;
+	}
+
+	// Vim writes a buffer holding one empty line as an empty file.
+	if (lines->n == 1 && lines->items[0].n == 0) return;
+
+	for (size_t l=0; l < lines->n; l++) {
+		const struct mp_value *line = &lines->items[l];
+		if (line->type != MP_STR) continue;
+
+		char *text = (char *) line->s;
+		for (char *c = text; (c = memchr(c, '\n', text + line->n - c)) != NULL; )
+			*c++ = '\0';
+		iov[niov++] = (struct iovec) { .iov_base = text, .iov_len = line->n };
+		if (l+1 < lines->n || newline)
+			iov[niov++] = (struct iovec) { .iov_base = &nl, .iov_len = 1 };
+
+		if (niov+2 > NVIM_IOV || l+1 == lines->n) {
+			for (int at = 0; at < niov; ) {
+				ssize_t n = pwritev(s->safd, iov + at, niov - at, offset);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) {
+					session_fail(s, 1, "Writing edited contents to storage area");
+					return;
+				}
+				offset += n;
+				// Skip what was written, trimming a partially written vector.
+				for (; at < niov && (size_t) n >= iov[at].iov_len; at++) n -= iov[at].iov_len;
+				if (at < niov) {
+					iov[at].iov_base = (char *) iov[at].iov_base + n;
+					iov[at].iov_len -= (size_t) n;
+				}
+			}
+			niov = 0;
+		}
+	}
+}
+
+/**
+ * @description - Hands the buffer back and lets the session carry on as if
+ *   a spawned editor had exited.
+ */
+static void nvim_finish(struct session *s) {
+	struct nvim *n = &s->nvim;
+	struct mp_buf b = { 0 };
+
+	// A notification rather than a request, there's nothing left to wait for.
+	mp_array(&b, 3);
+	mp_int(&b, RPC_NOTIFICATION);
+	mp_cstr(&b, "nvim_buf_delete");
+	mp_array(&b, 2);
+	mp_ext_int(&b, 0, n->buffer);
+	mp_map(&b, 1);
+	mp_cstr(&b, "force");
+	mp_bool(&b, true);
+	full_write(n->src.fd, b.data, b.size);
+	free(b.data);
+
+	evloop_del(&s->loop, &n->src);
+	close(n->src.fd);
+	n->src.fd = -1;
+	session_edited(s);
+}
+
+/**
+ * @description - Handles every complete message received so far.
+ * @argument s - the session
+ * @argument want - id of a response being waited for, or zero
+ * @argument result - receives the handle or id in that response
+ * @return - 1 when the wanted response arrived, 0 when it hasn't yet, -1 on
+ *   failure (recorded in the session).
+ */
+static int nvim_pump(struct session *s, uint32_t want, int64_t *result) {
+	struct nvim *n = &s->nvim;
+	struct mp_value msg;
+	size_t used = 0;
+	int found = 0;
+	ssize_t len;
+
+	// Decode only whole messages. Measuring resumes where the last read left
+	// off, so a big mvipe_write arriving over many reads is scanned once.
+	while (found == 0 && (len = mp_measure(&n->scan, n->in.data + used, n->in.size - used)) > 0) {
+		if (mp_decode(n->in.data + used, (size_t) len, &msg) != len) {
+			len = -1;
+			break;
+		}
+		used += (size_t) len;
+		if (msg.type != MP_ARRAY || msg.n < 3 || msg.items[0].type != MP_INT) {
+			mp_free(&msg);
+			continue;
+		}
+
+		const struct mp_value *kind = &msg.items[0];
+		if (kind->i == RPC_RESPONSE && msg.n == 4 && msg.items[1].i == want && want != 0) {
+			const struct mp_value *err = &msg.items[2], *value = &msg.items[3];
+			if (err->type != MP_NIL) {
+				const struct mp_value *text = err->type == MP_ARRAY && err->n > 1 ? &err->items[1] : NULL;
+				errno = 0;
+				session_fail(s, 1, "Neovim refused the buffer: %.*s",
+					text != NULL && text->type == MP_STR ? (int) text->n : 0,
+					text != NULL ? text->s : "");
+				found = -1;
+			}
+			else {
+				// Handles come back bare or wrapped; chan info is a map.
+				if (value->type == MP_MAP) value = mp_lookup(value, "id");
+				*result = value != NULL ? value->i : 0;
+				found = 1;
+			}
+		}
+		else if (kind->i == RPC_NOTIFICATION && msg.items[1].type == MP_STR) {
+			const struct mp_value *method = &msg.items[1], *params = &msg.items[2];
+			if (method->n == 11 && memcmp(method->s, "mvipe_write", 11) == 0
+			&& params->type == MP_ARRAY && params->n == 2 && params->items[0].type == MP_ARRAY) {
+				const struct mp_value *nl = &params->items[1];
+				nvim_store(s, &params->items[0], nl->type == MP_BOOL ? nl->b : nl->i != 0);
+			}
+			// Closed while setup still waits on a response: finished once it's done.
+			else if (method->n == 11 && memcmp(method->s, "mvipe_close", 11) == 0 && want != 0)
+				n->closed = true;
+			else if (method->n == 11 && memcmp(method->s, "mvipe_close", 11) == 0) {
+				mp_free(&msg);
+				n->in.size = 0;
+				n->scan = (struct mp_scan) { 0 };
+				nvim_finish(s);
+				return 0;
+			}
+		}
+		mp_free(&msg);
+	}
+
+	if (len < 0) {
+		errno = EPROTO;
+		session_fail(s, 1, "Neovim sent a malformed message");
+		found = -1;
+	}
+	memmove(n->in.data, n->in.data + used, n->in.size - used);
+	n->in.size -= used;
+	return found;
+}
+
+/**
+ * @description - Reads whatever the socket has into the receive buffer.
+ * @return - bytes read, zero at end of file, SAFE_READ_ERROR on failure.
+ */
+static size_t nvim_receive(struct nvim *n) {
+	if (n->in.cap - n->in.size < 4096) {
+		n->in.cap = MAX((size_t) 4096, 2 * n->in.cap);
+		n->in.data = xrealloc(n->in.data, n->in.cap);
+	}
+	size_t got = safe_read(n->src.fd, n->in.data + n->in.size, n->in.cap - n->in.size);
+	if (got != SAFE_READ_ERROR) n->in.size += got;
+	return got;
+}
+
+/**
+ * @description - Sends a request and blocks until it's answered.
+ * @return - zero on success, -1 on failure (recorded in the session).
+ */
+static int nvim_call(struct session *s, struct mp_buf *req, int64_t *result) {
+	struct nvim *n = &s->nvim;
+	int64_t ignored;
+	int found;
+
+	if (full_write(n->src.fd, req->data, req->size) != req->size) {
+		session_fail(s, 1, "Couldn't talk to Neovim");
+		return -1;
+	}
+	req->size = 0;
+
+	while ((found = nvim_pump(s, n->msgid, result != NULL ? result : &ignored)) == 0) {
+		size_t got = nvim_receive(n);
+		if (got == 0 || got == SAFE_READ_ERROR) {
+			if (got == 0) errno = ECONNRESET;
+			session_fail(s, 1, "Couldn't talk to Neovim");
+			return -1;
+		}
+	}
+	return found == 1 ? 0 : -1;
+}
+
+static void on_nvim(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct session *s = src->data;
+
+	size_t got = nvim_receive(&s->nvim);
+	if (got == SAFE_READ_ERROR) {
+		session_fail(s, 1, "Couldn't talk to Neovim");
+		return;
+	}
+	if (got == 0) {
+		// Neovim quit with the buffer still open; keep what was written.
+		evloop_del(loop, src);
+		close(src->fd);
+		src->fd = -1;
+		session_edited(s);
+		return;
+	}
+	nvim_pump(s, 0, NULL);
+}
+
+/**
+ * @description - Loads the storage area into lines requests, NVIM_BATCH
+ *   lines at a time.
+ * @return - zero on success, -1 on failure (recorded in the session).
+ */
+static int nvim_load(struct session *s, struct mp_buf *req, bool *newline) {
+	struct nvim *n = &s->nvim;
+	struct stat stat_buf;
+	*newline = true;
+
+	if (fstat(s->safd, &stat_buf) != 0) {
+		session_fail(s, 1, "Couldn't read storage area");
+		return -1;
+	}
+	if (stat_buf.st_size == 0) return 0;
+
+	size_t size = (size_t) stat_buf.st_size;
+	char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, s->safd, 0);
+	if (data == MAP_FAILED) {
+		session_fail(s, 1, "Couldn't read storage area");
+		return -1;
+	}
+
+	*newline = data[size-1] == '\n';
+	size_t end = *newline ? size - 1 : size;
+	bool first = true;
+	for (size_t at = 0; at <= end && s->status == 0; ) {
+		// Count up to a batch worth of lines from here.
+		size_t count = 0, scan = at;
+		while (count < NVIM_BATCH && scan <= end) {
+			char *nl = memchr(data + scan, '\n', end - scan);
+			scan = nl != NULL ? (size_t) (nl - data) + 1 : end + 1;
+			count++;
+		}
+
+		nvim_begin(req, n, "nvim_buf_set_lines", 5);
+		mp_ext_int(req, 0, n->buffer);
+		// The first batch replaces the empty line a new buffer starts with.
+		mp_int(req, first ? 0 : -1);
+		mp_int(req, -1);
+		mp_bool(req, false);
+		mp_array(req, count);
+		while (at < scan) {
+			char *nl = memchr(data + at, '\n', end - at);
+			size_t stop = nl != NULL ? (size_t) (nl - data) : end;
+			nvim_line(req, data + at, stop - at);
+			at = stop + 1;
+		}
+		first = false;
+		nvim_call(s, req, NULL);
+	}
+
+	munmap(data, size);
+	return s->status == 0 ? 0 : -1;
+}
+
+void session_nvim(struct session *s) {
+	struct nvim *n = &s->nvim;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct mp_buf req = { 0 };
+	char command[1024];
+	bool newline;
+
+	if (strlen(s->server) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		session_fail(s, 1, "Couldn't connect to Neovim at '%s'", s->server);
+		return;
+	}
+	strcpy(addr.sun_path, s->server);
+	n->src.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (n->src.fd < 0 || connect(n->src.fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		session_fail(s, 1, "Couldn't connect to Neovim at '%s'", s->server);
+		return;
+	}
+
+	nvim_begin(&req, n, "nvim_get_chan_info", 1);
+	mp_int(&req, 0);
+	if (nvim_call(s, &req, &n->channel) != 0) goto out;
+
+	nvim_begin(&req, n, "nvim_create_buf", 2);
+	mp_bool(&req, true);
+	mp_bool(&req, false);
+	if (nvim_call(s, &req, &n->buffer) != 0) goto out;
+
+	// Loading shouldn't be something the user can undo.
+	snprintf(command, sizeof(command),
+		"call setbufvar(%1$" PRId64 ", '&undolevels', -1)"
+		" | call setbufvar(%1$" PRId64 ", '&buftype', 'acwrite')"
+		" | call setbufvar(%1$" PRId64 ", '&bufhidden', 'hide')"
+		" | call setbufvar(%1$" PRId64 ", '&swapfile', 0)",
+		n->buffer);
+	nvim_begin(&req, n, "nvim_command", 1);
+	mp_cstr(&req, command);
+	if (nvim_call(s, &req, NULL) != 0) goto out;
+
+	snprintf(command, sizeof(command), "m-vipe://%d/%d", (int) getpid(), s->safd);
+	nvim_begin(&req, n, "nvim_buf_set_name", 2);
+	mp_ext_int(&req, 0, n->buffer);
+	mp_cstr(&req, command);
+	if (nvim_call(s, &req, NULL) != 0) goto out;
+
+	if (nvim_load(s, &req, &newline) != 0) goto out;
+
+	// An autocmd takes the rest of the line, bars included, so each of these
+	// has to go on its own. -123456 makes undolevels follow the global again.
+	const char *const finish[] = {
+		"call setbufvar(%1$" PRId64 ", '&eol', %3$d)"
+		" | call setbufvar(%1$" PRId64 ", '&undolevels', -123456)"
+		" | call setbufvar(%1$" PRId64 ", '&modified', 0)",
+		"autocmd BufWriteCmd <buffer=%1$" PRId64 "> call rpcnotify(%2$" PRId64 ", 'mvipe_write',"
+		" getbufline(%1$" PRId64 ", 1, '$'), getbufvar(%1$" PRId64 ", '&eol')"
+		" || (getbufvar(%1$" PRId64 ", '&fixeol') && !getbufvar(%1$" PRId64 ", '&binary')))"
+		" | call setbufvar(%1$" PRId64 ", '&modified', 0)",
+		"autocmd BufHidden,BufUnload <buffer=%1$" PRId64 "> ++once"
+		" call rpcnotify(%2$" PRId64 ", 'mvipe_close')",
+		"tab sbuffer %1$" PRId64,
+	};
+	for (size_t l=0; l < sizeof(finish) / sizeof(char*); l++) {
+		snprintf(command, sizeof(command), finish[l], n->buffer, n->channel, (int) newline);
+		nvim_begin(&req, n, "nvim_command", 1);
+		mp_cstr(&req, command);
+		if (nvim_call(s, &req, NULL) != 0) goto out;
+	}
+
+	n->src.callback = &on_nvim;
+	n->src.data = s;
+	if (evloop_add(&s->loop, &n->src, EPOLLIN) != 0)
+		session_fail(s, 1, "Couldn't watch Neovim");
+	else if (n->closed) {
+		n->in.size = 0;
+		n->scan = (struct mp_scan) { 0 };
+		nvim_finish(s);
+	}
+	// Anything that arrived alongside the last response won't wake the loop.
+	else if (n->in.size != 0)
+		nvim_pump(s, 0, NULL);
+
+	out:
+	free(req.data);
+}
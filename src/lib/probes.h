@@ -0,0 +1,32 @@
+// Static tracepoints for bpftrace, perf and friends.
+#ifndef MVIPE_PROBES_H
+#define MVIPE_PROBES_H
+
+/* NOTE:
+ *  Configured with -DMVIPE_PROBES=ON these become SystemTap style USDT
+ *  probes, provider `m_vipe`. sys/sdt.h only emits a nop and an ELF note
+ *  per probe, so it's needed to build but the result depends on nothing.
+ *  Otherwise they compile to nothing at all, arguments included. List them
+ *  with `bpftrace -l 'usdt:./m-vipe:*'`; for example
+ *    bpftrace -e 'usdt:./m-vipe:m_vipe:capture__read { @ = hist(arg0); }'
+ *
+ *  capture__start (int fd)                  input is about to be read
+ *  capture__read (size_t bytes)             one read from polled input
+ *  capture__done (uint64_t bytes)           input reached EOF
+ *  cat (int infd, int outfd, size_t bytes)  one read from input that can't be polled
+ *  resolve__candidate (char *cmd, int ok)   an editor was looked up in PATH
+ *  spawn (char *path, int pid, int errno)   posix_spawn returned
+ *  exit (int pid, int code, int status)     an editor was reaped, as siginfo
+ *  replay__start (size_t sinks, off_t from) the edit is about to be written
+ *  replay__write (char *sink, char *backend, ssize_t bytes) one write
+ *  replay__done (int status)                every sink is finished
+ */
+
+#ifdef MVIPE_PROBES
+#include <sys/sdt.h>
+#define PROBE(name, ...) STAP_PROBEV(m_vipe, name, __VA_ARGS__)
+#else
+#define PROBE(name, ...) do {} while (0)
+#endif
+
+#endif /* MVIPE_PROBES_H */
@@ -0,0 +1,158 @@
+// A pv style meter on the terminal during capture and replay, for `--progress`.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <gnulib/full-write.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+/* NOTE:
+ *  The meter only ever reads a byte counter the copy loops already keep, so
+ *  they pay nothing for it. A timer in the event loop redraws four times a
+ *  second, which also keeps elapsed time moving while a producer sits on
+ *  its hands. Loops that block the event loop, capture from and replay
+ *  to regular files, call progress_update per block instead: a coarse clock
+ *  read from the vDSO, which is no system call at all.
+ *
+ *  Nothing is drawn for the first half second, so quick runs don't flicker,
+ *  and the line is wiped when a phase ends to leave the terminal to the
+ *  editor or the prompt. With several m-vipe in one pipeline, only give one
+ *  of them `--progress`; the others may be drawing over its editor.
+ */
+
+#define PROGRESS_DELAY_NS (500 * 1000 * 1000LL)
+#define PROGRESS_EVERY_NS (250 * 1000 * 1000LL)
+
+static long long ns(struct timespec ts) {
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Formats size like `12.3 MiB`.
+static void human_size(char *out, size_t len, double size) {
+	static const char *const units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+	size_t unit = 0;
+	while (size >= 1024 && unit + 1 < sizeof(units) / sizeof(*units)) {
+		size /= 1024;
+		unit++;
+	}
+	snprintf(out, len, unit == 0 ? "%.0f %s" : "%.1f %s", size, units[unit]);
+}
+
+// Formats seconds like `1:02:03` or `2:03`.
+static void human_time(char *out, size_t len, long long secs) {
+	if (secs >= 3600)
+		snprintf(out, len, "%lld:%02lld:%02lld", secs / 3600, secs / 60 % 60, secs % 60);
+	else snprintf(out, len, "%lld:%02lld", secs / 60, secs % 60);
+}
+
+static void progress_draw(struct progress *p, long long now) {
+	char line[160], done[32], rate[32], elapsed[32], eta[32];
+	double secs = (double) (now - p->start) / 1e9;
+	uint64_t bytes = *p->bytes;
+
+	human_size(done, sizeof(done), (double) bytes);
+	human_size(rate, sizeof(rate), secs > 0 ? (double) bytes / secs : 0);
+	human_time(elapsed, sizeof(elapsed), (long long) secs);
+	int len = snprintf(line, sizeof(line), "\r%s: %s  %s/s  %s", p->phase, done, rate, elapsed);
+	if (p->total != 0 && bytes != 0 && bytes <= p->total) {
+		human_time(eta, sizeof(eta), (long long) (secs * (double) (p->total - bytes) / (double) bytes));
+		len += snprintf(line + len, sizeof(line) - (size_t) len, "  %3d%%  ETA %s",
+			(int) (bytes * 100 / p->total), eta);
+	}
+	len += snprintf(line + len, sizeof(line) - (size_t) len, "\033[K");
+
+	// A meter isn't worth failing over, the next redraw may well get through.
+	if (write(p->fd, line, (size_t) len) == len) p->drawn = true;
+}
+
+static void on_progress(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct progress *p = (struct progress *) src;
+	uint64_t expirations;
+	if (read(src->fd, &expirations, sizeof(expirations)) < 0) return;
+	progress_update(p);
+}
+
+void progress_init(struct progress *p) {
+	memset(p, 0, sizeof(*p));
+	p->tick = (struct ev_source) { .fd = -1, .callback = &on_progress };
+	p->fd = -1;
+}
+
+int progress_open(struct progress *p) {
+	// stderr when that's the terminal, so `2>log` keeps the meter out of logs.
+	if (isatty(STDERR_FILENO)) p->fd = STDERR_FILENO;
+	else {
+		p->fd = open("/dev/tty", O_WRONLY | O_NOCTTY | O_CLOEXEC);
+		p->owned = p->fd >= 0;
+	}
+	p->tick.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (p->fd >= 0 && p->tick.fd >= 0) return 0;
+	progress_close(p);
+	return -1;
+}
+
+void progress_begin(struct progress *p, struct evloop *loop, const char *phase,
+		const uint64_t *bytes, uint64_t total) {
+	struct timespec now;
+	struct itimerspec every = {
+		.it_interval = { .tv_nsec = PROGRESS_EVERY_NS },
+		.it_value = { .tv_nsec = PROGRESS_EVERY_NS },
+	};
+	if (p->fd < 0 || p->bytes != NULL) return;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	p->phase = phase;
+	p->bytes = bytes;
+	p->total = total;
+	p->start = ns(now);
+	p->next = p->start + PROGRESS_DELAY_NS;
+	p->drawn = false;
+	// Without the timer, the per block updates still draw.
+	if (timerfd_settime(p->tick.fd, 0, &every, NULL) == 0)
+		evloop_add(loop, &p->tick, EPOLLIN);
+}
+
+void progress_update(struct progress *p) {
+	struct timespec now;
+	if (p->bytes == NULL) return;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	if (ns(now) < p->next) return;
+	p->next = ns(now) + PROGRESS_EVERY_NS;
+	progress_draw(p, ns(now));
+}
+
+void progress_end(struct progress *p, struct evloop *loop) {
+	static const struct itimerspec off = { 0 };
+	if (p->bytes == NULL) return;
+
+	timerfd_settime(p->tick.fd, 0, &off, NULL);
+	evloop_del(loop, &p->tick);
+	if (p->drawn) full_write(p->fd, "\r\033[K", 4);
+	p->bytes = NULL;
+}
+
+void progress_close(struct progress *p) {
+	// Sessions that fail part way never get to progress_end.
+	if (p->bytes != NULL && p->drawn) full_write(p->fd, "\r\033[K", 4);
+	p->bytes = NULL;
+	if (p->owned) close(p->fd);
+	if (p->tick.fd >= 0) close(p->tick.fd);
+	p->fd = p->tick.fd = -1;
+	p->owned = false;
+}
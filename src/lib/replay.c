@@ -0,0 +1,398 @@
+// Writing the storage area back out to one or more sinks.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <error.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+const char *const replay_backends[] = {
+	[REPLAY_AUTO] = "auto",
+	[REPLAY_RW] = "rw",
+	[REPLAY_SENDFILE] = "sendfile",
+	[REPLAY_SPLICE] = "splice",
+	[REPLAY_VMSPLICE] = "vmsplice",
+	[REPLAY_COPY] = "copy",
+	NULL
+};
+
+/**
+ * @description - Looks up a replay backend by name.
+ * @argument name - the backend's name, NULL means auto
+ * @argument backend - receives the backend
+ * @return - zero on success, -1 when the name is unknown.
+ */
+int parse_replay_backend(const char *name, enum replay_backend *backend) {
+	*backend = REPLAY_AUTO;
+	if (name == NULL) return 0;
+	for (size_t l=0; replay_backends[l] != NULL; l++)
+		if (strcmp(name, replay_backends[l]) == 0) {
+			*backend = (enum replay_backend) l;
+			return 0;
+		}
+	return -1;
+}
+
+/**
+ * @description - How much of the storage area a sink's reader has actually
+ *   taken. Zero copy backends leave the storage pages themselves sitting in
+ *   the pipe, so anything still queued there doesn't count.
+ */
+off_t sink_consumed(struct sink *k) {
+	off_t emitted = k->replayed - (off_t) (k->pending - k->sent);
+	if (k->backend != REPLAY_RW && k->piped) {
+		int inpipe = 0;
+		if (ioctl(k->src.fd, FIONREAD, &inpipe) != 0) return 0;
+		emitted -= inpipe;
+	}
+	return emitted;
+}
+
+/**
+ * @description - Gives back the part of the storage area that every sink has
+ *   finished with. Holes are punched in whole pages, at most once per
+ *   buffer's worth of output unless `final` is set.
+ * @argument s - the replaying session
+ * @argument final - release everything up to the end of what was written
+ */
+void session_release(struct session *s, bool final) {
+	off_t page_size = (off_t) sysconf(_SC_PAGESIZE);
+
+	if (s->release != true) return;
+
+	// Punching out pages a reader still references corrupts its stream.
+	off_t consumed = sink_consumed(&s->sinks[0]);
+	for (size_t l=1; l < s->nsinks; l++)
+		consumed = MIN(consumed, sink_consumed(&s->sinks[l]));
+
+	off_t upto = final ? consumed : consumed - (consumed % page_size);
+	if (upto <= s->released) return;
+	if (final != true && upto - s->released < (off_t) s->bufsize) return;
+
+	if (fallocate(s->safd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			s->released, upto - s->released) != 0) {
+		// Not every tmpfile filesystem can punch holes; it's only an optimization.
+		if (s->verbose != 0) error(0, errno, "Error: Couldn't release storage");
+		s->release = false;
+		return;
+	}
+	s->released = upto;
+}
+
+/**
+ * @description - Moves the next block of the storage area to a sink without
+ *   staging it in a buffer.
+ * @argument s - the replaying session
+ * @argument k - the sink to write to
+ * @return - bytes moved, zero at the end of storage, -1 with errno set.
+ */
+ssize_t replay_zerocopy(struct session *s, struct sink *k) {
+	switch (k->backend) {
+		case REPLAY_SENDFILE: {
+			off_t off = k->replayed;
+			return sendfile(k->src.fd, s->safd, &off, s->bufsize);
+		}
+
+		case REPLAY_SPLICE: {
+			loff_t off = k->replayed;
+			return splice(s->safd, &off, k->src.fd, NULL, s->bufsize,
+				SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+		}
+
+		case REPLAY_VMSPLICE: {
+			if ((size_t) k->replayed >= s->mapsize) return 0;
+			// The pipe takes its own references on the pages, so they stay valid
+			// after we unmap or punch them. Nothing writes to the storage area
+			// once the editor is gone, which is what makes gifting them safe.
+			struct iovec iov = {
+				.iov_base = s->map + k->replayed,
+				.iov_len = MIN(s->bufsize, s->mapsize - (size_t) k->replayed),
+			};
+			return vmsplice(k->src.fd, &iov, 1, SPLICE_F_GIFT | SPLICE_F_NONBLOCK);
+		}
+
+		case REPLAY_COPY: {
+			// Regular files only. Large requests let the filesystem reflink or
+			// copy in-kernel in as few calls as possible.
+			loff_t off = k->replayed;
+			return copy_file_range(s->safd, &off, k->src.fd, NULL, (size_t) 1 << 30, 0);
+		}
+
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+}
+
+void session_replay_done(struct session *s) {
+	PROBE(replay__done, s->status);
+	stats_end(&s->stats, PHASE_REPLAY);
+	progress_end(&s->progress, &s->loop);
+	session_release(s, true);
+	if (s->map != NULL) munmap(s->map, s->mapsize);
+	s->map = NULL;
+	evloop_stop(&s->loop);
+}
+
+void sink_done(struct session *s, struct sink *k) {
+	k->done = true;
+	if (k->outflags != -1) fcntl(k->src.fd, F_SETFL, k->outflags);
+	// Stays open until the session ends, pages handed to a pipe may still be
+	// waiting for its reader and release needs to be able to ask.
+	evloop_del(&s->loop, &k->src);
+	if (k->buf != s->buf && k->buf != s->small) free(k->buf);
+	k->buf = NULL;
+
+	if (--s->live == 0) session_replay_done(s);
+}
+
+/**
+ * @description - Does one unit of writing to a sink. Non-blocking sinks may
+ *   make partial progress and get called again on the next EPOLLOUT.
+ * @argument s - the replaying session
+ * @argument k - the sink to write to
+ */
+void sink_step(struct session *s, struct sink *k) {
+	if (k->backend != REPLAY_RW) {
+		ssize_t n = replay_zerocopy(s, k);
+		PROBE(replay__write, k->name, replay_backends[k->backend], n);
+		k->io.writes++;
+		if (n > 0) {
+			k->io.bytes += (uint64_t) n;
+			k->replayed += n;
+			session_release(s, false);
+			return;
+		}
+		if (n == 0) { sink_done(s, k); return; }
+		if (errno == EAGAIN || errno == EINTR) return;
+		if (errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP
+				&& errno != EXDEV && errno != EBADF) {
+			session_fail(s, 1, "Writing modified contents to %s", k->name);
+			return;
+		}
+
+		// Nothing has been half written, so the plain loop can pick up at the
+		// same offset.
+		if (s->verbose != 0)
+			error(0, errno, "Error: %s replay unavailable", replay_backends[k->backend]);
+		k->backend = REPLAY_RW;
+	}
+
+	if (k->buf == NULL) k->buf = xmalloc(s->bufsize);
+
+	if (k->sent == k->pending && k->last) { sink_done(s, k); return; }
+	if (k->sent == k->pending) {
+		ssize_t n_read = pread(s->safd, k->buf, s->bufsize, k->replayed);
+		k->io.reads++;
+		if (n_read < 0) {
+			if (errno == EINTR) return;
+			session_fail(s, 1, "Writing modified contents to %s", k->name);
+			return;
+		}
+
+		if (n_read == 0) { sink_done(s, k); return; }
+
+		k->replayed += n_read;
+		k->pending = (size_t) n_read;
+		k->sent = 0;
+	}
+
+	// In release mode pipes are non-blocking, so this only writes what the
+	// consumer has room for and we come back on the next EPOLLOUT.
+	ssize_t n = write(k->src.fd, k->buf + k->sent, k->pending - k->sent);
+	PROBE(replay__write, k->name, replay_backends[REPLAY_RW], n);
+	k->io.writes++;
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR) return;
+		session_fail(s, 1, "Writing modified contents to %s", k->name);
+		return;
+	}
+	k->sent += (size_t) n;
+	k->io.bytes += (uint64_t) n;
+
+	session_release(s, false);
+	if (k->sent == k->pending && k->last) sink_done(s, k);
+}
+
+void on_output(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	sink_step(src->data, (struct sink *) src);
+}
+
+void sink_start(struct session *s, struct sink *k) {
+	struct stat stat_buf;
+	mode_t mode = fstat(k->src.fd, &stat_buf) == 0 ? stat_buf.st_mode : 0;
+
+	k->piped = S_ISFIFO(mode);
+	k->replayed = s->replay_from;
+	k->pending = k->sent = 0;
+	k->last = false;
+	k->outflags = -1;
+	k->done = false;
+	k->src.callback = &on_output;
+	k->src.data = s;
+
+	// Page references into a pipe are the cheapest way out of a memfd; a
+	// tmpfile on disk may not be cached, so leave the choice to the kernel.
+	k->backend = s->backend;
+	if (k->backend == REPLAY_AUTO)
+		k->backend = S_ISREG(mode) ? REPLAY_COPY
+			: k->piped && s->volat ? REPLAY_SPLICE
+			: REPLAY_RW;
+	if ((k->backend == REPLAY_SPLICE && k->piped != true)
+			|| (k->backend == REPLAY_VMSPLICE && (k->piped != true || s->map == NULL))
+			|| (k->backend == REPLAY_COPY && S_ISREG(mode) != true))
+		k->backend = REPLAY_RW;
+
+	// Already read in full, so it only has to be written.
+	if (s->replay_small) {
+		k->backend = REPLAY_RW;
+		k->buf = s->small;
+		k->pending = s->nsmall;
+		k->replayed += (off_t) s->nsmall;
+		k->last = true;
+	}
+
+	// Only pipes and sockets push back; anything else would just block or
+	// be unpollable anyway. Restore the flags after, the fd may be shared.
+	if (s->release && (k->piped || S_ISSOCK(mode))) {
+		k->outflags = fcntl(k->src.fd, F_GETFL);
+		if (k->outflags != -1)
+			fcntl(k->src.fd, F_SETFL, k->outflags | O_NONBLOCK);
+	}
+
+	if (evloop_add(&s->loop, &k->src, EPOLLOUT) != 0) {
+		// Regular files can't be polled, they're always "ready".
+		while (k->done != true && s->status == 0) {
+			sink_step(s, k);
+			progress_update(&s->progress);
+		}
+	}
+}
+
+// FNV-1a, continued from `hash`; only has to notice an edit, not resist one.
+static uint64_t emit_hash(uint64_t hash, const char *data, size_t size) {
+	for (size_t l=0; l < size; l++) hash = (hash ^ (unsigned char) data[l]) * 0x100000001b3;
+	return hash;
+}
+
+#define EMIT_HASH_INIT 0xcbf29ce484222325
+
+/**
+ * @description - Hashes part of the storage area into `hash`.
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int emit_hash_range(struct session *s, off_t from, off_t to, uint64_t *hash) {
+	while (from < to) {
+		ssize_t got = pread(s->safd, session_buf(s), MIN(s->bufsize, (size_t) (to - from)), from);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) return -1;
+		*hash = emit_hash(*hash, s->buf, (size_t) got);
+		from += got;
+	}
+	return 0;
+}
+
+void session_emit(struct session *s, bool final) {
+	struct stat stat_buf;
+	uint64_t hash = EMIT_HASH_INIT;
+
+	if (fstat(s->safd, &stat_buf) != 0 || emit_hash_range(s, 0,
+			MIN(s->emitted, stat_buf.st_size), &hash) != 0) {
+		session_fail(s, 1, "Reading the saved contents");
+		return;
+	}
+
+	// Appending is the common case for logs and notes; anything else means
+	// downstream gets the whole thing again.
+	off_t size = stat_buf.st_size;
+	off_t from = size >= s->emitted && hash == s->emithash ? s->emitted : 0;
+	if (from == 0) hash = EMIT_HASH_INIT;
+
+	// The editor is done; replay takes it from here with the usual backends.
+	if (final) {
+		s->replay_from = from;
+		return;
+	}
+	if (from == size) return;
+
+	// The editor may save again at any moment, so no page references into
+	// the storage area: copy out, and wait for every sink before moving on.
+	for (off_t at = from; at < size;) {
+		ssize_t got = pread(s->safd, session_buf(s), MIN(s->bufsize, (size_t) (size - at)), at);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) {
+			session_fail(s, 1, "Reading the saved contents");
+			return;
+		}
+		for (size_t l=0; l < s->nsinks; l++)
+			if (full_write(s->sinks[l].src.fd, s->buf, (size_t) got) != (size_t) got) {
+				session_fail(s, 1, "Writing saved contents to %s", s->sinks[l].name);
+				return;
+			}
+		hash = emit_hash(hash, s->buf, (size_t) got);
+		at += got;
+	}
+	if (s->verbose != 0)
+		fprintf(stderr, "Info: Emitted %s%lld bytes on save.\n",
+			from != 0 ? "an appended " : "", (long long) (size - from));
+	s->emitted = size;
+	s->emithash = hash;
+}
+
+void session_replay(struct session *s) {
+	PROBE(replay__start, s->nsinks, s->replay_from);
+	stats_begin(&s->stats, PHASE_REPLAY);
+	s->released = 0;
+	s->live = s->nsinks;
+	s->sinks[0].buf = s->buf;
+
+	// Small results skip the backends: one pread here, one write per sink.
+	struct stat sa_stat;
+	bool sized = fstat(s->safd, &sa_stat) == 0;
+	s->replay_small = false;
+	if (s->backend == REPLAY_AUTO && sized
+			&& sa_stat.st_size - s->replay_from <= (off_t) sizeof(s->small)) {
+		ssize_t got;
+		while ((got = pread(s->safd, s->small, sizeof(s->small), s->replay_from)) < 0
+			&& errno == EINTR);
+		s->sinks[0].io.reads++;
+		s->nsmall = got > 0 ? (size_t) got : 0;
+		s->replay_small = got >= 0;
+	}
+
+	// The primary output stands for all of them, tees only go as fast anyway.
+	if (s->replay_small != true && s->progress.fd >= 0 && sized)
+		progress_begin(&s->progress, &s->loop, "replay", &s->sinks[0].io.bytes,
+			(uint64_t) (sa_stat.st_size - s->replay_from));
+
+	if (s->backend == REPLAY_VMSPLICE) {
+		if (sized && sa_stat.st_size > 0) {
+			s->mapsize = (size_t) sa_stat.st_size;
+			s->map = mmap(NULL, s->mapsize, PROT_READ, MAP_SHARED, s->safd, 0);
+			if (s->map == MAP_FAILED) s->map = NULL;
+		}
+	}
+
+	for (size_t l=0; l < s->nsinks && s->status == 0; l++)
+		sink_start(s, &s->sinks[l]);
+}
@@ -0,0 +1,958 @@
+// The capture, edit, replay state machine and libmvipe's public entry points.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <error.h>
+#include <stdio.h>
+#include <limits.h>
+
+// External Includes
+#include <unistd.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <gnulib/safe-read.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+static _Thread_local char last_error[256];
+
+const char *mvipe_strerror(void) {
+	return last_error;
+}
+
+/**
+ * @description - Records why the session can't go on and stops the loop.
+ *   Only the first failure is kept; errno is captured as the cause.
+ * @argument s - the failing session, or NULL from an entry point that has
+ *   none, which just leaves the message for `mvipe_strerror`
+ * @argument status - exit status to report
+ * @argument format - printf style description
+ */
+void session_fail(struct session *s, int status, const char *format, ...) {
+	if (s == NULL) {
+		va_list ap;
+		va_start(ap, format);
+		vsnprintf(last_error, sizeof(last_error), format, ap);
+		va_end(ap);
+		return;
+	}
+	if (s->status == 0) {
+		va_list ap;
+		s->status = status;
+		s->error = errno;
+		va_start(ap, format);
+		vsnprintf(last_error, sizeof(last_error), format, ap);
+		va_end(ap);
+	}
+	evloop_stop(&s->loop);
+}
+
+/**
+ * @description - Hands the next batch of storage areas to an editor, or
+ *   moves on once every one of them has been edited.
+ */
+static void session_next(struct session *s) {
+	if (s->spawned < s->npaths) {
+		session_spawn(s);
+		return;
+	}
+
+	// The terminal is free for the next in line.
+	ttylock_close(&s->ttylock);
+	session_edited(s);
+}
+
+void session_finish_editor(struct session *s, const siginfo_t *info) {
+	PROBE(exit, s->child, info->si_code, info->si_status);
+	s->child = -1;
+	if (info->si_code == CLD_EXITED && s->launch.done != NULL) {
+		// That was only the multiplexer opening a pane; the pane reports the
+		// editor's exit itself.
+		if (info->si_status != 0) {
+			errno = 0;
+			session_fail(s, 1, "Couldn't open a new pane");
+		}
+		return;
+	}
+	else if (info->si_code == CLD_EXITED) {
+		if (s->verbose != 0) fprintf(stderr, "Info: Child exited normally.\n");
+	}
+	else {
+		switch(info->si_status) {
+			// TODO: specialize error reporting
+			default:
+				ttylock_close(&s->ttylock);
+				errno = 0;
+				session_fail(s, 1, "Editor was terminated by signal %d", info->si_status);
+				return;
+		}
+	}
+
+	session_next(s);
+}
+
+/**
+ * @description - Moves on from editing to replay, or stops when there's
+ *   nothing to replay to.
+ */
+void session_edited(struct session *s) {
+	stats_end(&s->stats, PHASE_EDIT);
+	if (s->saves.fd >= 0) {
+		evloop_del(&s->loop, &s->saves);
+		close(s->saves.fd);
+		s->saves.fd = -1;
+	}
+	if (s->emit_on_save && s->nsinks != 0) session_emit(s, true);
+	if (s->status != 0) return;
+
+	if (s->nsinks == 0) evloop_stop(&s->loop);
+	else session_replay(s);
+}
+
+void on_editor(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct session *s = src->data;
+	siginfo_t info; info.si_pid = 0;
+
+	// The pidfd only becomes readable once the child has terminated; stops
+	// and continues are reported through SIGCHLD instead.
+	if (waitid(P_PID, s->child, &info, WEXITED | WNOHANG) != 0 || info.si_pid == 0)
+		return;
+
+	evloop_del(loop, src);
+	close(src->fd);
+	src->fd = -1;
+	session_finish_editor(s, &info);
+}
+
+void on_pane(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct session *s = src->data;
+	char status[16];
+
+	// The wrapper writes the editor's exit status and closes; there's
+	// nothing to do with it but notice.
+	if (read(src->fd, status, sizeof(status)) < 0 && errno == EAGAIN) return;
+	evloop_del(loop, src);
+	close(src->fd);
+	src->fd = -1;
+	if (s->verbose != 0) fprintf(stderr, "Info: Editor pane closed.\n");
+	session_next(s);
+}
+
+void on_save(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct session *s = src->data;
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool saved = false;
+	ssize_t got;
+
+	if (s->polling) {
+		// Polling: a save is any change of size or modification time.
+		struct stat stat_buf;
+		uint64_t ticks;
+		if (read(src->fd, &ticks, sizeof(ticks)) < 0 || fstat(s->safd, &stat_buf) != 0) return;
+		saved = stat_buf.st_size != s->seen_size
+			|| stat_buf.st_mtim.tv_sec != s->seen_mtime.tv_sec
+			|| stat_buf.st_mtim.tv_nsec != s->seen_mtime.tv_nsec;
+		s->seen_size = stat_buf.st_size;
+		s->seen_mtime = stat_buf.st_mtim;
+	}
+	else while ((got = read(src->fd, buf, sizeof(buf))) > 0) saved = true;
+
+	if (saved) session_emit(s, false);
+}
+
+/**
+ * @description - Starts watching the storage area for saves. inotify sees
+ *   the editor close it after writing; where it can't watch, the size and
+ *   modification time are polled instead.
+ */
+static void session_watch_saves(struct session *s) {
+	s->saves.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (s->saves.fd >= 0 && inotify_add_watch(s->saves.fd, s->paths[0], IN_CLOSE_WRITE) >= 0
+			&& evloop_add(&s->loop, &s->saves, EPOLLIN) == 0)
+		return;
+	if (s->saves.fd >= 0) close(s->saves.fd);
+
+	struct stat stat_buf;
+	struct itimerspec every = { .it_interval = { 0, 250000000 }, .it_value = { 0, 250000000 } };
+	s->saves.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (s->saves.fd < 0 || fstat(s->safd, &stat_buf) != 0
+			|| timerfd_settime(s->saves.fd, 0, &every, NULL) != 0
+			|| evloop_add(&s->loop, &s->saves, EPOLLIN) != 0) {
+		if (s->saves.fd >= 0) close(s->saves.fd);
+		s->saves.fd = -1;
+		if (s->verbose != 0) error(0, errno, "Error: Can't watch for saves");
+		return;
+	}
+	s->polling = true;
+	s->seen_size = stat_buf.st_size;
+	s->seen_mtime = stat_buf.st_mtim;
+}
+
+void on_tty(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct session *s = src->data;
+	char drain[sizeof(struct inotify_event) + NAME_MAX + 1];
+
+	while (read(src->fd, drain, sizeof(drain)) > 0);
+	if (ttylock_poll(&s->ttylock) == 0) return;
+
+	struct ev_source *watch[] = { &s->ttywatch, &s->ttytick };
+	for (size_t l=0; l < 2; l++) {
+		evloop_del(loop, watch[l]);
+		close(watch[l]->fd);
+		watch[l]->fd = -1;
+	}
+	s->ttyheld = true;
+	session_spawn(s);
+}
+
+/**
+ * @description - Queues for the terminal the editor is about to take over.
+ *   Arbitration is best effort; when it can't be set up the editor simply
+ *   goes ahead as it always has.
+ * @return - true when the editor has to wait for its turn.
+ */
+static bool session_queue_tty(struct session *s) {
+	if (ttylock_open(&s->ttylock, s->launch.tty) != 0 || s->ttylock.fd < 0
+	|| ttylock_join(&s->ttylock) != 0)
+		return false;
+
+	struct itimerspec tick = {
+		.it_interval = { .tv_nsec = 250 * 1000 * 1000 },
+		.it_value = { .tv_nsec = 250 * 1000 * 1000 },
+	};
+	s->ttywatch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	s->ttytick.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (s->ttywatch.fd < 0 || s->ttytick.fd < 0
+	|| inotify_add_watch(s->ttywatch.fd, s->ttylock.path, IN_MODIFY) < 0
+	|| timerfd_settime(s->ttytick.fd, 0, &tick, NULL) != 0
+	|| evloop_add(&s->loop, &s->ttywatch, EPOLLIN) != 0
+	|| evloop_add(&s->loop, &s->ttytick, EPOLLIN) != 0) {
+		// Without a way to wait, don't hold up the rest of the queue either.
+		ttylock_close(&s->ttylock);
+		return false;
+	}
+
+	if (s->verbose != 0)
+		fprintf(stderr, "Info: Terminal is busy, waiting for its editor to close.\n");
+	return true;
+}
+
+/**
+ * @description - Fits the editor to what capture saw, once, before the first
+ *   spawn: binary input goes to binary_editor, large input to large_editor
+ *   or else to the usual editor without its configuration.
+ * @return - zero on success, nonzero after failing the session.
+ */
+static int session_adapt(struct session *s) {
+	struct editor_launch *el = &s->launch;
+	struct content *c = &s->content;
+	int status = 0;
+
+	if (s->adapted || s->input.fd < 0 || el->filter) return 0;
+	s->adapted = true;
+	content_end(c);
+
+	bool binary = s->binary_editor != NULL && content_binary(c);
+	bool large = (s->large_size != 0 && s->stats.capture.bytes >= s->large_size)
+		|| (s->large_lines != 0 && c->nlines >= s->large_lines)
+		|| (s->large_line != 0 && c->longest >= s->large_line);
+	if (binary) status = replace_editor(el, s->binary_editor);
+	else if (large && s->large_editor != NULL) status = replace_editor(el, s->large_editor);
+	else if (large) status = lighten_editor(el);
+
+	if (status != 0) {
+		errno = el->error;
+		session_fail(s, el->status, "%s", el->message);
+	}
+	else if (s->verbose != 0 && (binary || large))
+		fprintf(stderr, "Info: %s input (%llu bytes, %llu lines, longest %llu), using %s.\n",
+			binary ? "Binary" : "Large", (unsigned long long) s->stats.capture.bytes,
+			(unsigned long long) c->nlines, (unsigned long long) c->longest,
+			el->cargv[el->editor_at]);
+	return status;
+}
+
+void session_spawn(struct session *s) {
+	struct editor_launch *el = &s->launch;
+	posix_spawnattr_t attr;
+
+	stats_end(&s->stats, PHASE_CAPTURE);
+	progress_end(&s->progress, &s->loop);
+	if (s->server != NULL) {
+		stats_begin(&s->stats, PHASE_EDIT);
+		session_nvim(s);
+		return;
+	}
+
+	if (s->resolving) pthread_join(s->resolver, NULL);
+	s->resolving = false;
+	if (el->status != 0) {
+		errno = el->error;
+		session_fail(s, el->status, "%s", el->message);
+		return;
+	}
+	if (session_adapt(s) != 0) return;
+
+	if (s->parallel > 1 && s->npaths == 1) {
+		session_shard(s);
+		return;
+	}
+
+	// Only an editor on our own terminal has to take turns.
+	if (el->new_window == 0 && s->ttyheld != true && session_queue_tty(s)) return;
+
+	// Add as many storage areas as fit in ARG_MAX after the editor's own
+	// arguments and the environment, always at least one. The 2048 bytes of
+	// headroom are what POSIX asks of xargs.
+	size_t base = el->cargc, used = 2048;
+	size_t limit = (size_t) MAX(sysconf(_SC_ARG_MAX), (long) _POSIX_ARG_MAX);
+	for (char **e = environ; *e != NULL; e++) used += strlen(*e) + 1 + sizeof(char*);
+	for (size_t l=0; l < base; l++) used += strlen(el->cargv[l]) + 1 + sizeof(char*);
+	for (size_t first = s->spawned; s->spawned < s->npaths; s->spawned++) {
+		used += strlen(s->paths[s->spawned]) + 1 + sizeof(char*);
+		if (used > limit && s->spawned > first) break;
+		if (pushvar(&s->paths[s->spawned], &el->cargv, &el->cargc) != true) {
+			session_fail(s, 1, "Couldn't append required storage area argument.");
+			return;
+		}
+	}
+	if (s->verbose != 0 && s->spawned < s->npaths)
+		fprintf(stderr, "Info: Too many inputs for one editor, %zu left for the next.\n",
+			s->npaths - s->spawned);
+
+	// Open our end first; the wrapper's open for writing waits until we have.
+	if (el->done != NULL) {
+		s->pane.fd = open(el->done, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (s->pane.fd < 0 || evloop_add(&s->loop, &s->pane, EPOLLIN) != 0) {
+			session_fail(s, 1, "Couldn't watch the editor's pane");
+			return;
+		}
+	}
+
+	// Signals are blocked in m-vipe so the signalfd can see them; the editor
+	// must start with the user's original mask or job control breaks.
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &s->sigmask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	// NOTE: execv convention makes argument 0 a redundant copy of the
+	//   `program` argument; shifting the array will always ignore the first
+	//   entry in the supplied variadic list.
+	stats_begin(&s->stats, PHASE_SPAWN);
+	errno = posix_spawn(&s->child, el->cargv[0], &el->fact, &attr, el->cargv, environ);
+	PROBE(spawn, el->cargv[0], s->child, errno);
+	stats_end(&s->stats, PHASE_SPAWN);
+	stats_begin(&s->stats, PHASE_EDIT);
+	posix_spawnattr_destroy(&attr);
+	el->cargc = base;
+	el->cargv[base] = NULL;
+	if (errno != 0) {
+		s->child = -1;
+		session_fail(s, 1, "Failed to execute");
+		return;
+	}
+
+	// Only the first time round; a batch has no single stream to emit.
+	if (s->emit_on_save && s->nsinks != 0 && s->npaths == 1 && s->saves.fd < 0)
+		session_watch_saves(s);
+
+	s->editor.fd = (int) syscall(SYS_pidfd_open, s->child, 0);
+	if (s->editor.fd < 0 || evloop_add(&s->loop, &s->editor, EPOLLIN) != 0) {
+		// Pre 5.3 kernels have no pidfd; SIGCHLD will report the exit instead.
+		if (s->editor.fd >= 0) close(s->editor.fd);
+		s->editor.fd = -1;
+	}
+}
+
+/**
+ * @description - The copy buffer, allocated on first use: a session that
+ *   never reads input or copies out of the storage area doesn't pay for it.
+ * @return - s->buf, s->bufsize bytes long.
+ */
+char *session_buf(struct session *s) {
+	if (s->buf == NULL) s->buf = xmalloc(s->bufsize);
+	return s->buf;
+}
+
+/**
+ * @description - Reads input into s->small, so input that fits costs one
+ *   write to the storage area at EOF. Once it's full that is written out
+ *   and the session escalates to reading through buf.
+ * @return - bytes read, zero at EOF, SAFE_READ_ERROR with errno set.
+ */
+static size_t capture_small(struct session *s, int fd) {
+	size_t n_read = safe_read(fd, s->small + s->nsmall, sizeof(s->small) - s->nsmall);
+	s->stats.capture.reads++;
+	if (n_read == SAFE_READ_ERROR) return n_read;
+	content_scan(&s->content, s->small + s->nsmall, n_read);
+	s->stats.capture.bytes += n_read;
+	s->nsmall += n_read;
+	if (n_read != 0 && s->nsmall < sizeof(s->small)) return n_read;
+
+	if (s->nsmall != 0) {
+		s->stats.capture.writes++;
+		if (full_write(s->safd, s->small, s->nsmall) != s->nsmall) return SAFE_READ_ERROR;
+	}
+	s->escalated = n_read != 0;
+	return n_read;
+}
+
+/**
+ * @description - Does one read of input into the storage area, through
+ *   s->small until it overflows and the copy buffer after that.
+ * @return - bytes read, zero at EOF, SAFE_READ_ERROR with errno set.
+ */
+static size_t capture_step(struct session *s, int fd) {
+	size_t n_read;
+	if (s->escalated != true) n_read = capture_small(s, fd);
+	else {
+		n_read = safe_read(fd, session_buf(s), s->bufsize);
+		s->stats.capture.reads++;
+		if (n_read != SAFE_READ_ERROR && n_read != 0) {
+			content_scan(&s->content, s->buf, n_read);
+			s->stats.capture.writes++;
+			s->stats.capture.bytes += n_read;
+			if (full_write(s->safd, s->buf, n_read) != n_read) return SAFE_READ_ERROR;
+		}
+	}
+	return n_read;
+}
+
+void on_input(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct session *s = src->data;
+
+	// Only one read per wakeup, so a fast producer can't starve signals.
+	size_t n_read = capture_step(s, src->fd);
+	if (n_read == SAFE_READ_ERROR) {
+		if (errno == EAGAIN) return;
+		session_fail(s, 1, "Writing input to storage area");
+		return;
+	}
+	PROBE(capture__read, n_read);
+	if (n_read != 0) return;
+
+	PROBE(capture__done, s->stats.capture.bytes);
+	evloop_del(loop, src);
+	session_spawn(s);
+}
+
+void on_signal(struct evloop *loop, struct ev_source *src, uint32_t events) {
+	struct session *s = src->data;
+	struct signalfd_siginfo info;
+
+	if (read(src->fd, &info, sizeof(info)) != sizeof(info)) return;
+
+	switch (info.ssi_signo) {
+		case SIGCHLD:
+			if (s->nshards != 0) {
+				session_reap_shards(s);
+				return;
+			}
+			// Several state changes may have coalesced into one SIGCHLD, keep
+			// going until there's nothing left to report.
+			while (s->child > 0) {
+				siginfo_t ci; ci.si_pid = 0;
+				int options = WSTOPPED | WCONTINUED | WNOHANG;
+				// Without a pidfd this is the only place we hear about the exit.
+				if (s->editor.fd < 0) options |= WEXITED;
+				if (waitid(P_PID, s->child, &ci, options) != 0 || ci.si_pid == 0)
+					return;
+
+				switch (ci.si_code) {
+					case CLD_STOPPED: case CLD_TRAPPED:
+						fprintf(stderr, "Info: Child stopped, waiting for it to continue.\n");
+						break;
+					case CLD_CONTINUED:
+						fprintf(stderr, "Info: Child continued, waiting for valid termination.\n");
+						break;
+					default:
+						session_finish_editor(s, &ci);
+				}
+			}
+			return;
+
+		case SIGWINCH:
+			if (s->child > 0) kill(s->child, SIGWINCH);
+			return;
+
+		case SIGTSTP: case SIGTTIN: case SIGTTOU:
+			// Suspend the editor alongside us, then actually stop. SIGSTOP can't
+			// be blocked so this behaves like the default disposition would.
+			if (s->child > 0) kill(s->child, SIGTSTP);
+			raise(SIGSTOP);
+			return;
+
+		case SIGCONT:
+			if (s->child > 0) kill(s->child, SIGCONT);
+			return;
+	}
+}
+
+/**
+ * @description - Prepares a session around an existing storage area. The
+ *   caller adds its input and sinks, then hands it to `session_run`.
+ * @argument s - the session to set up
+ * @argument opts - settings, or NULL for the defaults
+ * @argument safd - the storage area
+ * @return - zero on success, an exit status otherwise.
+ */
+static int session_init(struct session *s, const struct mvipe_options *opts, int safd) {
+	static const struct mvipe_options defaults = { 0 };
+	if (opts == NULL) opts = &defaults;
+
+	memset(s, 0, sizeof(*s));
+	s->verbose = opts->verbose;
+	s->volat = opts->volat != 0;
+	s->release = opts->release != 0;
+	s->safd = safd;
+	s->child = -1;
+	s->loop.epfd = -1;
+	s->input = (struct ev_source) { .fd = -1, .callback = &on_input, .data = s };
+	s->signals = (struct ev_source) { .fd = -1, .callback = &on_signal, .data = s };
+	s->editor = (struct ev_source) { .fd = -1, .callback = &on_editor, .data = s };
+	s->nvim.src.fd = -1;
+	s->pane = (struct ev_source) { .fd = -1, .callback = &on_pane, .data = s };
+	s->saves = (struct ev_source) { .fd = -1, .callback = &on_save, .data = s };
+	s->emit_on_save = opts->emit_on_save != 0;
+	progress_init(&s->progress);
+	s->large_size = opts->large_size;
+	s->large_lines = opts->large_lines;
+	s->large_line = opts->large_line;
+	s->large_editor = opts->large_editor;
+	s->binary_editor = opts->binary_editor;
+	s->content.lines = s->large_lines != 0 || s->large_line != 0;
+	s->content.text = s->binary_editor != NULL;
+
+	s->stats.record = opts->stats_record != 0;
+	s->stats.enabled = s->stats.record;
+	if (opts->stats != NULL) {
+		s->stats.enabled = true;
+		s->stats.print = true;
+		s->stats.json = strcmp(opts->stats, "json") == 0;
+		s->stats.fd = opts->stats_fd > 0 ? opts->stats_fd : STDERR_FILENO;
+		if (s->stats.json != true && strcmp(opts->stats, "human") != 0) {
+			errno = EINVAL;
+			session_fail(s, 1, "Unknown stats format '%s'", opts->stats);
+			return s->status;
+		}
+	}
+	s->ttylock.fd = -1;
+	s->ttywatch = (struct ev_source) { .fd = -1, .callback = &on_tty, .data = s };
+	s->ttytick = (struct ev_source) { .fd = -1, .callback = &on_tty, .data = s };
+
+	if (parse_replay_backend(opts->replay, &s->backend) != 0) {
+		errno = EINVAL;
+		session_fail(s, 1, "Unknown replay backend '%s'", opts->replay);
+		return s->status;
+	}
+
+	s->launch.verbose = opts->verbose;
+	s->launch.new_window = opts->new_window;
+	s->launch.tty = opts->tty;
+	s->parallel = opts->parallel;
+	s->launch.filter = s->parallel > 1;
+
+	s->server = opts->server;
+	if (s->server != NULL && s->parallel > 1) {
+		errno = EINVAL;
+		session_fail(s, 1, "Neovim can't filter in parallel");
+		return s->status;
+	}
+	if (s->server == NULL && opts->argc == 0 && opts->new_window == 0 && s->parallel < 2) {
+		s->server = getenv("NVIM");
+		if (s->server == NULL) s->server = getenv("NVIM_LISTEN_ADDRESS");
+	}
+	s->launch.argc = opts->argc;
+	s->launch.argv = opts->argv;
+	posix_spawn_file_actions_init(&s->launch.fact);
+
+	// Last, so failing the checks above has nothing to clean up. Nowhere to
+	// draw just means no meter.
+	if (opts->progress != 0) progress_open(&s->progress);
+	return 0;
+}
+
+/**
+ * @description - Adds a destination for the edited contents.
+ * @argument s - the session to add to
+ * @argument fd - where to write
+ * @argument name - how to refer to it in errors
+ * @argument owned - close fd when the session ends
+ */
+static void session_add_sink(struct session *s, int fd, const char *name, bool owned) {
+	s->sinks = xreallocarray(s->sinks, s->nsinks + 1, sizeof(struct sink));
+	s->sinks[s->nsinks++] = (struct sink) {
+		.src = { .fd = fd },
+		.name = name,
+		.owned = owned,
+		.outflags = -1,
+	};
+}
+
+/**
+ * @description - Releases everything a session acquired, whether or not it
+ *   ever ran. The storage area itself belongs to the caller.
+ * @argument s - the session to tear down
+ */
+static void session_teardown(struct session *s) {
+	if (s->resolving) pthread_join(s->resolver, NULL);
+	s->resolving = false;
+	release_editor(&s->launch);
+
+	for (size_t l=0; l < s->nsinks; l++) {
+		struct sink *k = &s->sinks[l];
+		if (k->done != true && k->outflags != -1) fcntl(k->src.fd, F_SETFL, k->outflags);
+		if (k->buf != s->buf && k->buf != s->small) free(k->buf);
+		if (k->owned) close(k->src.fd);
+	}
+	session_drop_shards(s);
+	if (s->pane.fd >= 0) close(s->pane.fd);
+	if (s->saves.fd >= 0) close(s->saves.fd);
+	if (s->ttywatch.fd >= 0) close(s->ttywatch.fd);
+	if (s->ttytick.fd >= 0) close(s->ttytick.fd);
+	ttylock_close(&s->ttylock);
+	progress_close(&s->progress);
+	for (size_t l=0; l < s->npaths; l++) free(s->paths[l]);
+	free(s->paths);
+	s->paths = NULL;
+	s->npaths = 0;
+	if (s->nvim.src.fd >= 0) close(s->nvim.src.fd);
+	free(s->nvim.in.data);
+	s->nvim.in = (struct mp_buf) { 0 };
+	if (s->map != NULL) munmap(s->map, s->mapsize);
+	if (s->signals.fd >= 0) close(s->signals.fd);
+	if (s->loop.epfd >= 0) evloop_close(&s->loop);
+	free(s->sinks);
+	free(s->buf);
+	s->sinks = NULL;
+	s->nsinks = 0;
+	s->buf = NULL;
+}
+
+// Editor resolution on its helper thread, timed for `--stats`.
+static void *resolve_timed(void *arg) {
+	struct session *s = arg;
+	stats_begin(&s->stats, PHASE_RESOLVE);
+	resolve_editor(&s->launch);
+	stats_end(&s->stats, PHASE_RESOLVE);
+	return NULL;
+}
+
+/**
+ * @description - Runs a prepared session to completion: capture (when there
+ *   is an input), edit, then replay (when there are sinks).
+ * @argument s - the session to run
+ * @return - zero on success, an exit status otherwise.
+ */
+static int session_run(struct session *s) {
+	// Block the signals we forward before starting any threads, so that every
+	// thread inherits the mask and they're only ever seen by the signalfd.
+	sigset_t forward;
+	sigemptyset(&forward);
+	sigaddset(&forward, SIGCHLD);
+	sigaddset(&forward, SIGWINCH);
+	sigaddset(&forward, SIGTSTP);
+	sigaddset(&forward, SIGTTIN);
+	sigaddset(&forward, SIGTTOU);
+	sigaddset(&forward, SIGCONT);
+	pthread_sigmask(SIG_BLOCK, &forward, &s->sigmask);
+	clock_gettime(CLOCK_MONOTONIC, &s->stats.start);
+
+	if (evloop_init(&s->loop) != 0) {
+		session_fail(s, 1, "Couldn't create event loop");
+		goto restore;
+	}
+	s->signals.fd = signalfd(-1, &forward, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (s->signals.fd < 0 || evloop_add(&s->loop, &s->signals, EPOLLIN) != 0) {
+		session_fail(s, 1, "Couldn't watch signals");
+		goto restore;
+	}
+
+	s->bufsize = s->input.fd >= 0 ? cat_blksize(s->input.fd, s->safd) : 0;
+	for (size_t l=0; l < s->nsinks; l++)
+		s->bufsize = MAX(s->bufsize, cat_blksize(s->safd, s->sinks[l].src.fd));
+
+	if (s->paths == NULL) {
+		s->paths = xmalloc(sizeof(char*));
+		s->paths[0] = storage_path(s->safd);
+		s->npaths = 1;
+	}
+
+	// Editor resolution doesn't depend on the storage area at all, so let it
+	// race the producer instead of adding to time-to-editor.
+	if (s->server == NULL) {
+		if ((errno = pthread_create(&s->resolver, NULL, &resolve_timed, s)) != 0) {
+			session_fail(s, 1, "Couldn't start editor resolution");
+			goto restore;
+		}
+		s->resolving = true;
+	}
+
+	if (s->input.fd >= 0) {
+		struct stat in_stat;
+		PROBE(capture__start, s->input.fd);
+		stats_begin(&s->stats, PHASE_CAPTURE);
+		// Only a regular file says up front how much is coming.
+		if (s->progress.fd >= 0)
+			progress_begin(&s->progress, &s->loop, "capture", &s->stats.capture.bytes,
+				fstat(s->input.fd, &in_stat) == 0 && S_ISREG(in_stat.st_mode)
+				? (uint64_t) in_stat.st_size : 0);
+	}
+	if (s->input.fd < 0)
+		session_spawn(s);
+	else if (evloop_add(&s->loop, &s->input, EPOLLIN) != 0) {
+		// Regular files and /dev/null can't be polled; they never block anyway.
+		size_t n_read;
+		while ((n_read = capture_step(s, s->input.fd)) != SAFE_READ_ERROR) {
+			PROBE(cat, s->input.fd, s->safd, n_read);
+			if (n_read == 0) break;
+			progress_update(&s->progress);
+		}
+		if (n_read == SAFE_READ_ERROR)
+			session_fail(s, 1, "Writing input to storage area");
+		else {
+			PROBE(capture__done, s->stats.capture.bytes);
+			session_spawn(s);
+		}
+	}
+
+	if (s->status == 0 && evloop_run(&s->loop) != 0)
+		session_fail(s, 1, "Event loop failed");
+
+	restore:
+	pthread_sigmask(SIG_SETMASK, &s->sigmask, NULL);
+	if (s->resolving) pthread_join(s->resolver, NULL);
+	s->resolving = false;
+	stats_report(s);
+	histogram_record(s);
+	session_teardown(s);
+
+	errno = s->error;
+	return s->status;
+}
+
+int mvipe_run(const struct mvipe_options *opts, int infd, int outfd) {
+	struct session s;
+	FILE *safp = NULL;
+
+	int safd = storage_open(opts != NULL && opts->volat != 0, &safp);
+	if (safd < 0) {
+		snprintf(last_error, sizeof(last_error), "Couldn't create storage area");
+		return 1;
+	}
+
+	if (session_init(&s, opts, safd) == 0) {
+		s.input.fd = infd;
+		session_add_sink(&s, outfd, "stdout", false);
+
+		// Open the tees up front so a bad path fails before anyone starts editing.
+		for (size_t l=0; opts != NULL && l < opts->ntees && s.status == 0; l++) {
+			const char *path = opts->tees[l];
+			int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+			if (fd < 0) session_fail(&s, 1, "Couldn't open '%s'", path);
+			else session_add_sink(&s, fd, path, true);
+		}
+
+		if (s.status == 0) session_run(&s);
+		else session_teardown(&s);
+	}
+
+	int status = s.status, err = s.error;
+	if (safp != NULL) fclose(safp); else close(safd);
+	errno = err;
+	return status;
+}
+
+int mvipe_prepare(const struct mvipe_options *opts) {
+	struct session s;
+
+	if (session_init(&s, opts, -1) != 0) return s.status;
+	resolve_editor(&s.launch);
+	if (s.launch.status != 0) {
+		errno = s.launch.error;
+		session_fail(&s, s.launch.status, "%s", s.launch.message);
+	}
+	release_editor(&s.launch);
+
+	errno = s.error;
+	return s.status;
+}
+
+int mvipe_edit_fd(const struct mvipe_options *opts, int fd) {
+	return mvipe_edit_fds(opts, &fd, 1);
+}
+
+int mvipe_edit_fds(const struct mvipe_options *opts, const int *fds, size_t count) {
+	struct session s;
+
+	if (count == 0) return 0;
+	if (session_init(&s, opts, fds[0]) != 0) return s.status;
+	// Only fail when asked for Neovim outright; an inherited $NVIM just
+	// means we're inside one, and an ordinary editor will do.
+	if (s.server != NULL && count > 1 && (opts == NULL || opts->server == NULL))
+		s.server = NULL;
+	if (s.server != NULL && count > 1) {
+		errno = EINVAL;
+		session_fail(&s, 1, "Neovim can only be handed one input at a time");
+		session_teardown(&s);
+		return s.status;
+	}
+
+	// The editor writes through its own open file description; ours are
+	// left wherever the caller had them.
+	s.paths = xcalloc(count, sizeof(char*));
+	s.npaths = count;
+	for (size_t l=0; l < count; l++) s.paths[l] = storage_path(fds[l]);
+	return session_run(&s);
+}
+
+int mvipe_filter_fd(const struct mvipe_options *opts, int fd) {
+	char *path = storage_path(fd);
+	int status = mvipe_filter_path(opts, path);
+	int err = errno;
+	free(path);
+	errno = err;
+	return status;
+}
+
+int mvipe_filter_path(const struct mvipe_options *opts, const char *path) {
+	struct session s;
+	posix_spawnattr_t attr;
+	siginfo_t info;
+
+	if (session_init(&s, opts, -1) != 0) return s.status;
+	if (opts != NULL && opts->server != NULL) {
+		errno = EINVAL;
+		session_fail(&s, 1, "Neovim can't be used as a filter");
+		goto done;
+	}
+	s.launch.filter = true;
+	resolve_editor(&s.launch);
+	if (s.launch.status != 0) {
+		errno = s.launch.error;
+		session_fail(&s, s.launch.status, "%s", s.launch.message);
+		goto done;
+	}
+
+	// No event loop: a filter has no terminal to share and no job control
+	// to forward, and waiting on its pid is safe from any thread.
+	char *arg = xstrdup(path);
+	if (pushvar(&arg, &s.launch.cargv, &s.launch.cargc) != true) {
+		free(arg);
+		session_fail(&s, 1, "Couldn't append required storage area argument.");
+		goto done;
+	}
+	posix_spawnattr_init(&attr);
+	errno = posix_spawn(&s.child, s.launch.cargv[0], &s.launch.fact, &attr,
+		s.launch.cargv, environ);
+	PROBE(spawn, s.launch.cargv[0], s.child, errno);
+	posix_spawnattr_destroy(&attr);
+	free(arg);
+	if (errno != 0) {
+		session_fail(&s, 1, "Failed to execute");
+		goto done;
+	}
+
+	while (waitid(P_PID, s.child, &info, WEXITED) != 0)
+		if (errno != EINTR) {
+			session_fail(&s, 1, "Lost track of the editor");
+			goto done;
+		}
+	PROBE(exit, s.child, info.si_code, info.si_status);
+	errno = 0;
+	if (info.si_code != CLD_EXITED)
+		session_fail(&s, 1, "Editor was terminated by signal %d", info.si_status);
+	else if (info.si_status != 0)
+		session_fail(&s, 1, "Editor exited with status %d", info.si_status);
+
+	done:
+	session_teardown(&s);
+	errno = s.error;
+	return s.status;
+}
+
+int mvipe_storage_open(const struct mvipe_options *opts) {
+	FILE *safp = NULL;
+	int fd = storage_open(opts != NULL && opts->volat != 0, &safp);
+	if (fd < 0 || safp == NULL) return fd;
+
+	// The stream is only in the way; keep the descriptor.
+	fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	int err = errno;
+	fclose(safp);
+	errno = err;
+	return fd;
+}
+
+int mvipe_edit_buffer(const struct mvipe_options *opts,
+		const void *data, size_t size, struct mvipe_buffer *out) {
+	struct session s;
+	FILE *safp = NULL;
+	struct stat stat_buf;
+
+	out->data = NULL;
+	out->size = 0;
+
+	int safd = storage_open(opts != NULL && opts->volat != 0, &safp);
+	if (safd < 0) {
+		snprintf(last_error, sizeof(last_error), "Couldn't create storage area");
+		return 1;
+	}
+
+	// One write straight into the storage area is the only copy going in.
+	if (full_write(safd, data, size) != size) {
+		int err = errno;
+		snprintf(last_error, sizeof(last_error), "Writing input to storage area");
+		if (safp != NULL) fclose(safp); else close(safd);
+		errno = err;
+		return 1;
+	}
+
+	int status = session_init(&s, opts, safd);
+	if (status == 0) status = session_run(&s);
+
+	// And coming out the result is mapped rather than read, the mapping keeps
+	// the storage area alive after it's closed.
+	if (status == 0 && fstat(safd, &stat_buf) == 0 && stat_buf.st_size > 0) {
+		out->data = mmap(NULL, (size_t) stat_buf.st_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, safd, 0);
+		if (out->data == MAP_FAILED) {
+			out->data = NULL;
+			snprintf(last_error, sizeof(last_error), "Couldn't map edited contents");
+			status = 1;
+		}
+		else out->size = (size_t) stat_buf.st_size;
+	}
+
+	int err = errno;
+	if (safp != NULL) fclose(safp); else close(safd);
+	errno = err;
+	return status;
+}
+
+void mvipe_buffer_free(struct mvipe_buffer *buf) {
+	if (buf->data != NULL) munmap(buf->data, buf->size);
+	buf->data = NULL;
+	buf->size = 0;
+}
@@ -0,0 +1,235 @@
+// Running a non-interactive editor over slices of the storage area at once.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/sendfile.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+/* NOTE:
+ *  `--parallel=N` is GNU parallel's `--pipe` inside the storage engine. Once
+ *  capture is done the storage area is cut into N slices of about the same
+ *  size, each ending on a newline or NUL so no record is split, and every
+ *  slice gets its own storage area and its own editor. When all of them have
+ *  exited cleanly the slices are put back into the storage area in their
+ *  original order and replayed like any other edit.
+ *
+ *  Shards are real files in a private directory, not /proc/PID/fd/N paths:
+ *  filters that edit in place, like `sed -i`, write a copy beside the file
+ *  and rename it over, and need a directory to do that in. So reassembly
+ *  reads whatever is at each shard's path once its editor has exited.
+ */
+
+/**
+ * @description - Finds where the record containing `at` ends.
+ * @return - the offset just past its newline or NUL, or size.
+ */
+static size_t record_end(const char *map, size_t size, size_t at) {
+	if (at >= size) return size;
+
+	// memchr is vectorized in every libc worth using; look for a newline,
+	// then only as far as it for a NUL.
+	const char *end = memchr(map + at, '\n', size - at);
+	size_t span = (end != NULL ? (size_t) (end - map) : size) - at;
+	const char *nul = memchr(map + at, '\0', span);
+	if (nul != NULL) end = nul;
+	return end != NULL ? (size_t) (end - map) + 1 : size;
+}
+
+void session_shard(struct session *s) {
+	struct editor_launch *el = &s->launch;
+	struct stat stat_buf;
+	posix_spawnattr_t attr;
+	char *map = NULL;
+
+	if (fstat(s->safd, &stat_buf) != 0) {
+		session_fail(s, 1, "Couldn't size the storage area");
+		return;
+	}
+	size_t size = (size_t) stat_buf.st_size;
+	if (size != 0) {
+		map = mmap(NULL, size, PROT_READ, MAP_SHARED, s->safd, 0);
+		if (map == MAP_FAILED) {
+			session_fail(s, 1, "Couldn't map the storage area");
+			return;
+		}
+	}
+
+	// Volatile input stays off disk: XDG_RUNTIME_DIR is a private tmpfs.
+	const char *tmp = s->volat ? getenv("XDG_RUNTIME_DIR") : NULL;
+	if (tmp == NULL || *tmp == '\0') tmp = getenv("TMPDIR");
+	if (tmp == NULL || *tmp == '\0') tmp = "/tmp";
+	s->sharddir = xmalloc(strlen(tmp) + sizeof("/m-vipe.XXXXXX"));
+	strcpy(s->sharddir, tmp);
+	strcat(s->sharddir, "/m-vipe.XXXXXX");
+	if (mkdtemp(s->sharddir) == NULL) {
+		free(s->sharddir);
+		s->sharddir = NULL;
+		if (map != NULL) munmap(map, size);
+		session_fail(s, 1, "Couldn't create a directory for shards");
+		return;
+	}
+
+	// Never more shards than bytes, but always one so an empty input still
+	// goes through the editor.
+	size_t count = MAX(1, MIN((size_t) s->parallel, size));
+	s->shards = xcalloc(count, sizeof(struct shard));
+	for (size_t start = 0, l = 0; l < count && (start < size || l == 0); l++) {
+		size_t end = l+1 == count ? size : record_end(map, size, MAX(start, size / count * (l+1)));
+		struct shard *sh = &s->shards[s->nshards++];
+		sh->pid = -1;
+		sh->path = xmalloc(strlen(s->sharddir) + sizeof("/shard-XXXXXX"));
+		strcpy(sh->path, s->sharddir);
+		strcat(sh->path, "/shard-XXXXXX");
+		sh->fd = mkostemp(sh->path, O_CLOEXEC);
+		if (sh->fd < 0) {
+			free(sh->path);
+			sh->path = NULL;
+		}
+		if (sh->fd < 0 || full_write(sh->fd, map + start, end - start) != end - start) {
+			if (map != NULL) munmap(map, size);
+			session_fail(s, 1, "Couldn't create a shard");
+			return;
+		}
+		start = end;
+	}
+	if (map != NULL) munmap(map, size);
+
+	// Every byte is in a shard now; don't hold on to it twice.
+	if (ftruncate(s->safd, 0) != 0) {
+		session_fail(s, 1, "Couldn't empty the storage area");
+		return;
+	}
+	if (s->verbose != 0)
+		fprintf(stderr, "Info: Filtering %zu bytes as %zu shards.\n", size, s->nshards);
+
+	// Signals are blocked in m-vipe so the signalfd can see them; the
+	// editors must start with the user's original mask.
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &s->sigmask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+	for (size_t l=0; l < s->nshards; l++) {
+		struct shard *sh = &s->shards[l];
+		size_t base = el->cargc;
+		if (pushvar(&sh->path, &el->cargv, &el->cargc) != true) {
+			session_fail(s, 1, "Couldn't append required storage area argument.");
+			break;
+		}
+		errno = posix_spawn(&sh->pid, el->cargv[0], &el->fact, &attr, el->cargv, environ);
+		PROBE(spawn, el->cargv[0], sh->pid, errno);
+		el->cargc = base;
+		el->cargv[base] = NULL;
+		if (errno != 0) {
+			sh->pid = -1;
+			session_fail(s, 1, "Failed to execute");
+			break;
+		}
+		s->running++;
+	}
+	posix_spawnattr_destroy(&attr);
+}
+
+/**
+ * @description - Puts the filtered shards back into the storage area, in
+ *   order, then moves on to replay.
+ */
+static void session_unshard(struct session *s) {
+	// Capture left the offset at the old end; sendfile writes at the offset.
+	if (lseek(s->safd, 0, SEEK_SET) != 0) {
+		session_fail(s, 1, "Couldn't rewind the storage area");
+		return;
+	}
+	for (size_t l=0; l < s->nshards; l++) {
+		struct shard *sh = &s->shards[l];
+		struct stat stat_buf;
+		off_t off = 0;
+		// The filter may have renamed a new file over ours; take what's there.
+		close(sh->fd);
+		sh->fd = open(sh->path, O_RDONLY | O_CLOEXEC);
+		if (sh->fd < 0 || fstat(sh->fd, &stat_buf) != 0) {
+			session_fail(s, 1, "Couldn't open shard %zu", l+1);
+			return;
+		}
+		while (off < stat_buf.st_size) {
+			if (sendfile(s->safd, sh->fd, &off, (size_t) (stat_buf.st_size - off)) > 0) continue;
+			if (errno == EINTR) continue;
+			session_fail(s, 1, "Couldn't reassemble shard %zu", l+1);
+			return;
+		}
+	}
+
+	session_drop_shards(s);
+	session_edited(s);
+}
+
+void session_reap_shards(struct session *s) {
+	for (size_t l=0; l < s->nshards; l++) {
+		struct shard *sh = &s->shards[l];
+		siginfo_t info; info.si_pid = 0;
+		if (sh->pid <= 0) continue;
+		// Stops and continues don't matter; the shards share our process
+		// group, so job control reaches them directly.
+		if (waitid(P_PID, sh->pid, &info, WEXITED | WNOHANG) != 0 || info.si_pid == 0)
+			continue;
+
+		PROBE(exit, sh->pid, info.si_code, info.si_status);
+		sh->pid = -1;
+		s->running--;
+		errno = 0;
+		if (info.si_code != CLD_EXITED) {
+			session_fail(s, 1, "Editor was terminated by signal %d on shard %zu",
+				info.si_status, l+1);
+			return;
+		}
+		// Unlike a person, a filter that fails has left garbage behind.
+		if (info.si_status != 0) {
+			session_fail(s, 1, "Editor exited with status %d on shard %zu",
+				info.si_status, l+1);
+			return;
+		}
+	}
+
+	if (s->running == 0 && s->status == 0) session_unshard(s);
+}
+
+void session_drop_shards(struct session *s) {
+	for (size_t l=0; l < s->nshards; l++) {
+		struct shard *sh = &s->shards[l];
+		// Only left running when another shard failed or we're interrupted.
+		if (sh->pid > 0) {
+			kill(sh->pid, SIGTERM);
+			waitpid(sh->pid, NULL, 0);
+		}
+		if (sh->fd >= 0) close(sh->fd);
+		if (sh->path != NULL) unlink(sh->path);
+		free(sh->path);
+	}
+	free(s->shards);
+	s->shards = NULL;
+	// Filters may leave their own temporaries behind when they're killed;
+	// those stay, and so does the directory.
+	if (s->sharddir != NULL) rmdir(s->sharddir);
+	free(s->sharddir);
+	s->sharddir = NULL;
+	s->nshards = s->running = 0;
+}
@@ -0,0 +1,167 @@
+// Where a session's time goes, for `--stats`.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+// External Includes
+#include <unistd.h>
+#include <sys/resource.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+static const char *const phase_names[PHASES] = {
+	[PHASE_CAPTURE] = "capture",
+	[PHASE_RESOLVE] = "resolve",
+	[PHASE_SPAWN] = "spawn",
+	[PHASE_EDIT] = "edit",
+	[PHASE_REPLAY] = "replay",
+};
+
+static double seconds(struct timeval tv) {
+	return (double) tv.tv_sec + (double) tv.tv_usec / 1e6;
+}
+
+void stats_begin(struct stats *st, enum stats_phase p) {
+	struct phase *ph = &st->phases[p];
+	if (st->enabled != true || ph->running) return;
+
+	// Resolution is the only phase on a helper thread, and it runs while
+	// capture is still going; the process totals would count both twice.
+	ph->who = p == PHASE_RESOLVE ? RUSAGE_THREAD : RUSAGE_SELF;
+	ph->running = true;
+	getrusage(ph->who, &ph->ru0);
+	clock_gettime(CLOCK_MONOTONIC, &ph->wall0);
+	if (p == PHASE_EDIT && st->to_editor == 0)
+		st->to_editor = (double) (ph->wall0.tv_sec - st->start.tv_sec)
+			+ (double) (ph->wall0.tv_nsec - st->start.tv_nsec) / 1e9;
+}
+
+void stats_end(struct stats *st, enum stats_phase p) {
+	struct phase *ph = &st->phases[p];
+	struct timespec now;
+	struct rusage ru;
+	if (st->enabled != true || ph->running != true) return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	getrusage(ph->who, &ru);
+	ph->running = false;
+	ph->wall += (double) (now.tv_sec - ph->wall0.tv_sec)
+		+ (double) (now.tv_nsec - ph->wall0.tv_nsec) / 1e9;
+	ph->user += seconds(ru.ru_utime) - seconds(ph->ru0.ru_utime);
+	ph->sys += seconds(ru.ru_stime) - seconds(ph->ru0.ru_stime);
+	ph->minflt += ru.ru_minflt - ph->ru0.ru_minflt;
+	ph->majflt += ru.ru_majflt - ph->ru0.ru_majflt;
+}
+
+// Names come from the command line; keep the JSON valid whatever they are.
+static void json_string(FILE *out, const char *str) {
+	fputc('"', out);
+	for (const unsigned char *c = (const unsigned char *) str; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+		else if (*c < 0x20) fprintf(out, "\\u%04x", *c);
+		else fputc(*c, out);
+	}
+	fputc('"', out);
+}
+
+void stats_report(struct session *s) {
+	struct stats *st = &s->stats;
+	struct rusage self, children;
+	char *report = NULL;
+	size_t size = 0;
+
+	if (st->enabled != true) return;
+	for (int p=0; p < PHASES; p++) stats_end(st, (enum stats_phase) p);
+	if (st->print != true) return;
+	content_end(&s->content);
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+
+	// Built whole and written at once so it can't interleave with anything.
+	FILE *out = open_memstream(&report, &size);
+	if (out == NULL) return;
+
+	if (st->json) {
+		fprintf(out, "{\"status\":%d,\"to_editor_ms\":%.3f,\"phases\":{",
+			s->status, st->to_editor * 1e3);
+		for (int p=0; p < PHASES; p++) {
+			const struct phase *ph = &st->phases[p];
+			fprintf(out, "%s\"%s\":{\"wall_ms\":%.3f,\"user_ms\":%.3f,\"sys_ms\":%.3f,"
+				"\"minflt\":%ld,\"majflt\":%ld}", p != 0 ? "," : "", phase_names[p],
+				ph->wall * 1e3, ph->user * 1e3, ph->sys * 1e3, ph->minflt, ph->majflt);
+		}
+		fprintf(out, "},\"capture\":{\"bytes\":%llu,\"reads\":%llu,\"writes\":%llu},"
+			"\"buffer_size\":%zu,\"sinks\":[",
+			(unsigned long long) st->capture.bytes, (unsigned long long) st->capture.reads,
+			(unsigned long long) st->capture.writes, s->bufsize);
+		for (size_t l=0; l < s->nsinks; l++) {
+			const struct sink *k = &s->sinks[l];
+			fprintf(out, "%s{\"name\":", l != 0 ? "," : "");
+			json_string(out, k->name);
+			fprintf(out, ",\"backend\":\"%s\",\"bytes\":%llu,\"reads\":%llu,\"writes\":%llu}",
+				replay_backends[k->backend], (unsigned long long) k->io.bytes,
+				(unsigned long long) k->io.reads, (unsigned long long) k->io.writes);
+		}
+		fprintf(out, "]");
+		if (s->content.lines || s->content.text) {
+			fprintf(out, ",\"content\":{");
+			if (s->content.lines)
+				fprintf(out, "\"lines\":%llu,\"longest_line\":%llu%s",
+					(unsigned long long) s->content.nlines, (unsigned long long) s->content.longest,
+					s->content.text ? "," : "");
+			if (s->content.text)
+				fprintf(out, "\"nuls\":%llu,\"utf8\":%s", (unsigned long long) s->content.nuls,
+					s->content.invalid ? "false" : "true");
+			fprintf(out, "}");
+		}
+		fprintf(out, ",\"children\":{\"user_ms\":%.3f,\"sys_ms\":%.3f},"
+			"\"minflt\":%ld,\"majflt\":%ld,\"peak_rss_kb\":%ld}\n",
+			seconds(children.ru_utime) * 1e3, seconds(children.ru_stime) * 1e3,
+			self.ru_minflt, self.ru_majflt, self.ru_maxrss);
+	}
+	else {
+		fprintf(out, "m-vipe stats (status %d, editor up after %.3f ms):\n",
+			s->status, st->to_editor * 1e3);
+		fprintf(out, "  %-8s %11s %11s %11s %8s %8s\n",
+			"phase", "wall ms", "user ms", "sys ms", "minflt", "majflt");
+		for (int p=0; p < PHASES; p++) {
+			const struct phase *ph = &st->phases[p];
+			fprintf(out, "  %-8s %11.3f %11.3f %11.3f %8ld %8ld\n", phase_names[p],
+				ph->wall * 1e3, ph->user * 1e3, ph->sys * 1e3, ph->minflt, ph->majflt);
+		}
+		fprintf(out, "  capture: %llu bytes in %llu reads, %llu writes; buffer %zu bytes\n",
+			(unsigned long long) st->capture.bytes, (unsigned long long) st->capture.reads,
+			(unsigned long long) st->capture.writes, s->bufsize);
+		for (size_t l=0; l < s->nsinks; l++) {
+			const struct sink *k = &s->sinks[l];
+			fprintf(out, "  replay to %s: %s, %llu bytes in %llu reads, %llu writes\n",
+				k->name, replay_backends[k->backend], (unsigned long long) k->io.bytes,
+				(unsigned long long) k->io.reads, (unsigned long long) k->io.writes);
+		}
+		if (s->content.lines)
+			fprintf(out, "  content: %llu lines, longest %llu bytes\n",
+				(unsigned long long) s->content.nlines, (unsigned long long) s->content.longest);
+		if (s->content.text)
+			fprintf(out, "  content: %llu NULs, %s\n", (unsigned long long) s->content.nuls,
+				s->content.invalid ? "not UTF-8" : "valid UTF-8");
+		fprintf(out, "  editor cpu: %.3f ms user, %.3f ms sys\n",
+			seconds(children.ru_utime) * 1e3, seconds(children.ru_stime) * 1e3);
+		fprintf(out, "  faults: %ld minor, %ld major; peak rss %ld KiB\n",
+			self.ru_minflt, self.ru_majflt, self.ru_maxrss);
+	}
+
+	if (fclose(out) == 0) {
+		ssize_t n = write(st->fd, report, size);
+		(void) n; // Nowhere left to report a failure to report.
+	}
+	free(report);
+}
@@ -0,0 +1,127 @@
+// Storage area management and the plain blocking copy loop.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+
+// External Includes
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gnulib/stat-size.h> // TODO: get licensing sorted for gnulib
+#include <gnulib/safe-read.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+#include <gnulib/intprops.h>
+
+// Internal Includes
+#include "internal.h"
+#include "ioblksize.h"
+
+
+/**
+ * @description - Picks the transfer size for copying between two fds.
+ * @argument infd - the descriptor being read from
+ * @argument outfd - the descriptor being written to
+ * @return - the larger of both descriptors' optimal block sizes.
+ */
+size_t cat_blksize(int infd, int outfd) {
+	size_t insize, outsize;
+
+	struct stat stat_buf;
+	stat_buf.st_blksize = 0; // ensure no undefined behavior on fstat error
+	fstat (infd, &stat_buf); // this should be fine without error handling
+	insize = io_blksize(stat_buf);
+	fstat (outfd, &stat_buf);
+	outsize = io_blksize(stat_buf);
+
+	// All values herein are MAXed so they should at least default to a decent
+	// size. `io_blksize` in gnulib actually has a builtin default. Be careful
+	// however, MAX is a macro.
+	return MAX(insize, outsize);
+}
+
+// Near clone of simple_cat from coreutils. Thanks for that guys! Makes buffer
+// management easier on my end. Returns -1 with errno set on failure. Counts
+// the calls it makes into count, which may be NULL.
+int very_simple_cat(int infd, int outfd, struct io_count *count) {
+	struct io_count ignored;
+	if (count == NULL) count = &ignored;
+
+	/* NOTE:
+	 *  Lucky for me I'm not really wanting to target all the systems on earth.
+	 *  GNU coreutils does a lot of funky stuff in cat.c because some systems
+	 *  like Cygwin actually distingquish between BINARY and TEXT io on pipes
+	 *  files. Which is a little bit rediculous in C. This cuts out a lot of their
+	 *  well intentioned scaffolding in favor of a simpler, easier to maintain
+	 *  method.
+	 *
+	 *  If this ever does get integrated into moreutils or some other
+	 *  GNU toolchain, I imagine this will need to get refactored to target
+	 *  systems like Cygwin again.
+	 */
+
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+	/* Optimal size of i/o operations of input.  */
+	size_t insize = cat_blksize(infd, outfd);
+
+	char* buf = xmalloc(insize + page_size - 1);
+
+	size_t n_read;
+	while (true) {
+		n_read = safe_read(infd, buf, insize);
+		count->reads++;
+		if (n_read == SAFE_READ_ERROR) {
+			free(buf);
+			return -1;
+		}
+
+		if (n_read == 0) { free(buf); return 0; }
+
+		{
+			/* The following is ok, since we know that 0 < n_read.  */
+			size_t n = n_read;
+			count->writes++;
+			count->bytes += n;
+			if (full_write(outfd, buf, n) != n) {
+				free(buf);
+				return -1;
+			}
+		}
+	}
+}
+
+/**
+ * @description - Creates an empty storage area. Will set errno on error.
+ * @argument volat - keep the contents in RAM instead of on disk
+ * @argument safp - receives the stream backing a tmpfile, or NULL for a memfd
+ * @return - the storage area's descriptor, or -1 on failure.
+ */
+int storage_open(bool volat, FILE **safp) {
+	*safp = NULL;
+	if (volat) return memfd_create("ramfile", MFD_CLOEXEC);
+
+	*safp = tmpfile();
+	return *safp == NULL ? -1 : fileno(*safp);
+}
+
+/**
+ * @description - Names the storage area so the editor can open it.
+ * @argument safd - the storage area's descriptor
+ * @return - a malloc allocated `/proc/$$/fd/$FD` path.
+ */
+char *storage_path(int safd) {
+	// `/proc/$$/fd/$FD`, sized at compile time; INT_BUFSIZE_BOUND has room
+	// for a sign and the null char.
+	char filename[sizeof("/proc//fd/") - 1 + 2 * INT_BUFSIZE_BOUND(int)];
+
+	// NOTE: linux pid_t is signed int so this should be safe.
+	int len = sprintf(filename, "/proc/%d/fd/%d", getpid(), safd);
+	return xmemdup(filename, (size_t) len + 1);
+}
@@ -0,0 +1,164 @@
+// Taking turns on a terminal shared by several m-vipe processes.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include "internal.h"
+
+
+/* NOTE:
+ *  `a | m-vipe | b | m-vipe | c` runs both instances at once, and either may
+ *  finish capturing first. Each terminal gets a queue file listing the pids
+ *  waiting for it, one per line, oldest first; whoever is at the front owns
+ *  the terminal. The file is only ever touched under a short flock, and
+ *  pids that no longer exist are dropped on every pass, so a killed
+ *  instance can't hold the terminal forever.
+ */
+
+/**
+ * @description - Finds the device number of the terminal the editor will
+ *   use: the given fd, or else our controlling terminal.
+ * @return - the device, or zero when there's no terminal.
+ */
+static dev_t tty_device(int tty) {
+	struct stat stat_buf;
+	if (tty > 0)
+		return fstat(tty, &stat_buf) == 0 && S_ISCHR(stat_buf.st_mode) ? stat_buf.st_rdev : 0;
+
+	// Opening /dev/tty only yields /dev/tty's own inode, the real device
+	// is the seventh field of our stat.
+	FILE *stat = fopen("/proc/self/stat", "re");
+	if (stat == NULL) return 0;
+	unsigned long long dev = 0;
+	char line[1024];
+	if (fgets(line, sizeof(line), stat) != NULL) {
+		// The command name may contain anything, skip past its parenthesis.
+		char *rest = strrchr(line, ')');
+		if (rest != NULL) sscanf(rest, ") %*c %*d %*d %*d %llu", &dev);
+	}
+	fclose(stat);
+	return (dev_t) dev;
+}
+
+int ttylock_open(struct ttylock *t, int tty) {
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	char name[64];
+
+	t->fd = -1;
+	t->queued = false;
+	dev_t dev = tty_device(tty);
+	if (dev == 0) return 0;
+
+	// /tmp is shared, so keep users apart; the runtime dir is already ours.
+	if (dir == NULL || *dir == '\0') {
+		dir = "/tmp";
+		snprintf(name, sizeof(name), "/m-vipe-%u-tty-%u.%u.lock",
+			(unsigned) getuid(), major(dev), minor(dev));
+	}
+	else snprintf(name, sizeof(name), "/m-vipe-tty-%u.%u.lock", major(dev), minor(dev));
+
+	t->path = xmalloc(strlen(dir) + strlen(name) + 1);
+	strcpy(t->path, dir);
+	strcat(t->path, name);
+	t->fd = open(t->path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+	return t->fd < 0 ? -1 : 0;
+}
+
+/**
+ * @description - Rewrites the queue under the lock: drops dead pids, then
+ *   optionally adds or removes our own.
+ * @argument t - the queue
+ * @argument change - 1 to join the back, -1 to leave, 0 to only tidy up
+ * @return - 1 when we're at the front afterwards, 0 when not, -1 on error.
+ */
+static int ttylock_update(struct ttylock *t, int change) {
+	pid_t self = getpid(), *pids = NULL;
+	size_t count = 0, cap = 0;
+	bool dirty = false;
+	char buf[4096];
+	ssize_t got;
+	off_t at = 0;
+
+	while (flock(t->fd, LOCK_EX) != 0)
+		if (errno != EINTR) return -1;
+
+	// Parse the whole queue; it only ever holds a handful of pids.
+	char carry[32]; size_t ncarry = 0;
+	while ((got = pread(t->fd, buf, sizeof(buf), at)) > 0) {
+		at += got;
+		for (ssize_t l=0; l < got; l++) {
+			if (buf[l] != '\n') {
+				if (ncarry + 1 < sizeof(carry)) carry[ncarry++] = buf[l];
+				continue;
+			}
+			carry[ncarry] = '\0';
+			ncarry = 0;
+			pid_t pid = (pid_t) strtol(carry, NULL, 10);
+			// Anyone who isn't around anymore, or is us rejoining, goes.
+			if (pid <= 0 || (kill(pid, 0) != 0 && errno == ESRCH) || (pid == self && change != 0)) {
+				dirty = true;
+				continue;
+			}
+			if (count == cap) pids = x2nrealloc(pids, &cap, sizeof(pid_t));
+			pids[count++] = pid;
+		}
+	}
+	if (ncarry != 0) dirty = true;
+
+	if (change > 0) {
+		if (count == cap) pids = x2nrealloc(pids, &cap, sizeof(pid_t));
+		pids[count++] = self;
+		dirty = true;
+	}
+
+	int status = got < 0 ? -1 : count != 0 && pids[0] == self;
+	if (dirty && status >= 0) {
+		size_t len = 0;
+		char *out = xmalloc(count * 24 + 1);
+		for (size_t l=0; l < count; l++)
+			len += (size_t) sprintf(out + len, "%ld\n", (long) pids[l]);
+		if (ftruncate(t->fd, 0) != 0 || pwrite(t->fd, out, len, 0) != (ssize_t) len)
+			status = -1;
+		free(out);
+	}
+
+	flock(t->fd, LOCK_UN);
+	free(pids);
+	return status;
+}
+
+int ttylock_join(struct ttylock *t) {
+	int status = ttylock_update(t, 1);
+	t->queued = status >= 0;
+	return status;
+}
+
+int ttylock_poll(struct ttylock *t) {
+	return ttylock_update(t, 0);
+}
+
+void ttylock_close(struct ttylock *t) {
+	if (t->queued) ttylock_update(t, -1);
+	t->queued = false;
+	if (t->fd >= 0) close(t->fd);
+	t->fd = -1;
+	free(t->path);
+	t->path = NULL;
+}
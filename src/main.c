@@ -5,337 +5,135 @@
 
 // Standard Includes
 #include <stdbool.h>
-#include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
 #include <errno.h>
 #include <error.h>
-#include <stdio.h>
-#include <math.h>
 
 // External Includes
-#include <unistd.h> // may need to be included before string.h for strdup
-#include <spawn.h>
+#include <unistd.h>
 #include <fcntl.h>
-#include <limits.h> // ARG_MAX
-#include <sys/mman.h>
-#include <sys/wait.h>
-#include <gnulib/stat-size.h> // TODO: get licensing sorted for gnulib
-#include <gnulib/safe-read.h>
-#include <gnulib/full-write.h>
 #include <gnulib/xalloc.h>
 #include <argparse.h>
 
 // Internal Includes
 #include <m-vipe.h>
-#include "die.h"
-#include "ioblksize.h"
-
-
-/**
- * NOTE: See https://stackoverflow.com/questions/3437404/min-and-max-in-c
- *   for why this implementation is better and should probably be migrated to
- *   gnulib.
- */
-#define max(a,b)           \
-({                         \
-	__typeof__ (a) _a = (a); \
-	__typeof__ (b) _b = (b); \
-	_a > _b ? _a : _b;       \
-})
-#define min(a,b)           \
-({                         \
-	__typeof__ (a) _a = (a); \
-	__typeof__ (b) _b = (b); \
-	_a < _b ? _a : _b;       \
-})
-#undef MAX
-#undef MIN
-#define MAX max
-#define MIN min
-
-// NOTE: how large a space we need to contain the following objects
-//       using binary growth
-#define BINALLOC(size, count) ( \
-	size * ((1 << (int) floor(log2((count) * size))) >> 1) \
-)
+#include <mvipe.h>
+#include "daemon.h"
+#include "batch.h"
+#include "each.h"
+#include "dir.h"
 
 
 static const char *const usage[] = {
-	"m-vipe [-Vwv] [-f FILE] [[--] EDITOR [ARGS...]]",
+	"m-vipe [-Vwv] [-f FILE] [--client] [[--] EDITOR [ARGS...]]",
+	"m-vipe [-Vv] [-f FILE] --parallel=N [--] FILTER [ARGS...]",
+	"m-vipe [-Vv] [--parallel=N] --each FILE... [-- FILTER [ARGS...]]",
+	"m-vipe [-Vwv] --dir=DIR [[--] EDITOR [ARGS...]]",
+	"m-vipe [-Vwv] (-0 | -f FILE...) [--in-place] [--separator=STR] [[--] EDITOR [ARGS...]]",
+	"m-vipe --daemon [[--] EDITOR [ARGS...]]",
+	"m-vipe --stats-report",
 	"m-vipe [-h] [--version]",
 	NULL,
 };
 
+struct path_list {
+	const char **paths;
+	size_t count;
+};
 
-// Near clone of simple_cat from coreutils. Thanks for that guys! Makes buffer
-// management easier on my end.
-int very_simple_cat(const char *action, int infd, int outfd) {
-	/* NOTE:
-	 *  Lucky for me I'm not really wanting to target all the systems on earth.
-	 *  GNU coreutils does a lot of funky stuff in cat.c because some systems
-	 *  like Cygwin actually distingquish between BINARY and TEXT io on pipes
-	 *  files. Which is a little bit rediculous in C. This cuts out a lot of their
-	 *  well intentioned scaffolding in favor of a simpler, easier to maintain
-	 *  method.
-	 *
-	 *  If this ever does get integrated into moreutils or some other
-	 *  GNU toolchain, I imagine this will need to get refactored to target
-	 *  systems like Cygwin again.
-	 */
-
-	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
-
-	/* Optimal size of i/o operations of input.  */
-	size_t insize, outsize;
-
-	struct stat stat_buf;
-	stat_buf.st_blksize = 0; // ensure no undefined behavior on fstat error
-	fstat (infd, &stat_buf); // this should be fine without error handling
-	insize = io_blksize(stat_buf);
-	fstat (outfd, &stat_buf);
-	outsize = io_blksize(stat_buf);
-
-	// All values herein are MAXed so they should at least default to a decent
-	// size. `io_blksize` in gnulib actually has a builtin default. Be careful
-	// however, MAX is a macro.
-	insize = MAX(insize, outsize);
-
-	char* buf = xmalloc(insize + page_size - 1);
-
-	size_t n_read;
-	while (true) {
-		n_read = safe_read(infd, buf, insize);
-		if (n_read == SAFE_READ_ERROR)
-			die(1, errno, action);
-
-		if (n_read == 0) return 0;
-
-		{
-			/* The following is ok, since we know that 0 < n_read.  */
-			size_t n = n_read;
-			if (full_write(outfd, buf, n) != n)
-				die(1, errno, action);
-		}
-	}
+// Argparse only keeps the last value of an option; collect every `--tee`
+// and `--from`.
+int collect_path(struct argparse *self, const struct argparse_option *option) {
+	struct path_list *list = (struct path_list *) option->data;
+	list->paths = xreallocarray(list->paths, list->count + 1, sizeof(char*));
+	list->paths[list->count++] = *(const char **) option->value;
+	return 0;
 }
 
 /**
- * @description - Performs path search, shell argument expansion and
- *   concatenation of variadic string arguments. Will set errno on error.
- *   All errors inherited from realloc and access.
- * @argument str - previously malloc allocated string to add
- * @argument argv - malloc allocated variadic argument container
- * @argument argc - a pointer to the count of variadic arguments contain by argv
- * @return - True when str contained a command found in PATH, false otherwise.
+ * @description - Parses a count like `300M`, with an optional binary K, M,
+ *   G or T suffix.
+ * @return - zero on success, -1 when str isn't one.
  */
-bool shexpaccvar(char **str, char ***argv, size_t *argc) {
-	// Use two pass algorithm to decide whether or not we need to extend the
-	// variadic args list. Use binary exponential growth when expanding like
-	// C++ strings for malloc efficency.
-
-	// TODO: make this function and shpaccvar not fail when user supplied full path.
-	if (*str == NULL) return false;
-
-	// NOTE: This isn't actually a "correct" use for IFS. Though it's not very far off.
-	//   See: https://web.archive.org/web/20210513070928/http://mywiki.wooledge.org/IFS
-	char *ifs = " \t\n";
-	char *path = getenv("PATH"); if (path == NULL) path="";
-	size_t slenb = strlen(*str) * sizeof(char);
-	size_t plenb = strlen(path) * sizeof(char);
-
-	// Count the new arguments after IFS parsing and prep reuse of str in-place
-	size_t nc = *argc+1;
-	for (char *c, *acc=*str; (c=strpbrk(acc, ifs)) != NULL; acc=c+sizeof(char)) {
-		nc++;
-		*c = '\0';
+static int parse_size(const char *str, unsigned long long *size) {
+	static const char units[] = "KMGT";
+	char *end;
+	if (isdigit((unsigned char) *str) == 0) return -1;
+	errno = 0;
+	*size = strtoull(str, &end, 10);
+	if (errno != 0) return -1;
+	const char *unit = *end != '\0' ? strchr(units, toupper((unsigned char) *end)) : NULL;
+	if (unit != NULL) {
+		int shift = 10 * (int) (unit - units + 1);
+		if (*size > ULLONG_MAX >> shift) return -1;
+		*size <<= shift;
+		end++;
 	}
-
-	// Extend the argument pointer array if necessary.
-	size_t nb = BINALLOC(sizeof(void*), nc+1);
-	size_t ob = BINALLOC(sizeof(void*), (*argc)+1);
-	if (nb >= ob) {
-		if (*argv == NULL)
-			*argv = malloc(nb);
-		else
-			*argv = realloc(*argv, nb);
-		if (*argv == NULL)
-			return false;
-	}
-
-	if (access(*str, R_OK | X_OK) != 0) {
-		// Reallocate str to buffer PATH search
-		*str = realloc(*str, plenb + slenb + 2*sizeof(char)); // + pathsep & NULL
-		if (*str == NULL) return false;
-
-		// NOTE: remove when regression testing is finished.
-		*((*str)+plenb+slenb) = '\0'; // append null to reallocated space as a precaution
-
-		// perform PATH search
-		char *c, *sloc=*str, *pacc=path;
-		for (;(c=strpbrk(pacc, ":")) != NULL; pacc=c+sizeof(char)) {
-			// move str value to be in front of path segment, then memcpy path
-			// into place.
-			plenb = c - pacc;
-			sloc=memmove((*str)+plenb+sizeof(char), sloc, slenb+sizeof(char));
-			memcpy(*str, pacc, plenb);
-			*((*str)+plenb) = '/'; // replace fieldsep with POSIX pathsep
-
-			int s = access(*str, R_OK | X_OK);
-			if (s == 0) break;
-		}
-		// Final pass / when IFS not found
-		if (c == NULL) {
-			plenb = strlen(pacc) * sizeof(char);
-			sloc=memmove((*str)+plenb+sizeof(char), sloc, slenb+sizeof(char));
-			memcpy(*str, pacc, plenb);
-			*((*str)+plenb) = '/';
-
-			int s = access(*str, R_OK | X_OK);
-			if (s == -1) return false;
-		}
-		slenb += plenb+sizeof(char);
-	}
-
-	// Populate args from buffer
-	errno=0;
-	(*argv)[(*argc)++] = *str;
-	for (size_t l=0; l < (slenb/sizeof(char)); l++)
-		if ((*str)[l] == '\0')
-			(*argv)[(*argc)++] = &((*str)[l+1]);
-
-	(*argv)[*argc] = (char *) NULL;
-	return true;;
+	return *end == '\0' ? 0 : -1;
 }
 
-bool shpaccvar(char **str, char ***argv, size_t *argc) {
-	// Use two pass algorithm to decide whether or not we need to extend the
-	// variadic args list. Use binary exponential growth when expanding like
-	// C++ strings for malloc efficency.
+// Set while running on behalf of a `--client`, which can't start daemons.
+static bool served = false;
 
-	if (*str == NULL) return false;
+// Editor given to `--daemon`, used by clients that don't name their own.
+static int served_argc = 0;
+static const char **served_argv = NULL;
 
-	char *path = getenv("PATH");
-	size_t slenb = strlen(*str) * sizeof(char);
-	size_t plenb = strlen(path) * sizeof(char);
+static int run(int argc, const char **argv, int tty);
 
-	// Extend the argument pointer array if necessary.
-	size_t nc = *argc+1;
-	size_t nb = BINALLOC(sizeof(void*), nc+1);
-	size_t ob = BINALLOC(sizeof(void*), (*argc)+1);
-	if (nb >= ob) {
-		if (*argv == NULL)
-			*argv = malloc(nb);
-		else
-			*argv = realloc(*argv, nb);
-		if (*argv == NULL)
-			return false;
-	}
-
-	if (access(*str, R_OK | X_OK) != 0) {
-		// Reallocate str to buffer PATH search
-		*str = realloc(*str, plenb + slenb + 2*sizeof(char)); // + pathsep & NULL
-		if (*str == NULL) return false;
-
-		// NOTE: remove when regression testing is finished.
-		*((*str)+plenb+slenb) = '\0'; // append null to reallocated space as a precaution
-
-		// perform PATH search
-		char *c, *sloc=*str, *pacc=path;
-		for (;(c=strpbrk(pacc, ":")) != NULL; pacc=c+sizeof(char)) {
-			// move str value to be in front of path segment, then memcpy path
-			// into place.
-			plenb = c - pacc;
-			sloc = memmove((*str)+plenb+sizeof(char), sloc, slenb+sizeof(char));
-			memcpy(*str, pacc, plenb);
-			*((*str)+plenb) = '/'; // replace fieldsep with POSIX pathsep
-
-			int s = access(*str, R_OK | X_OK);
-			if (s == 0) break;
-		}
-		// Final pass / when IFS not found
-		if (c == NULL) {
-			plenb = strlen(pacc) * sizeof(char);
-			sloc = memmove((*str)+plenb+sizeof(char), sloc, slenb+sizeof(char));
-			memcpy(*str, pacc, plenb);
-			*((*str)+plenb) = '/';
-
-			int s = access(*str, R_OK | X_OK);
-			if (s == -1) return false;
-		}
-	}
-
-	// Populate args from buffer
-	errno=0;
-	(*argv)[(*argc)++] = *str;
-	(*argv)[*argc] = (char *) NULL;
-	return true;;
-}
-
-bool pushvar(char **str, char ***argv, size_t *argc) {
-	size_t nb = BINALLOC(sizeof(void*) , (*argc)+2);
-	size_t ob = BINALLOC(sizeof(void*), (*argc)+1);
-	if (nb >= ob) {
-		if (*argv == NULL)
-			*argv = malloc(nb);
-		else
-			*argv = realloc(*argv, nb);
-		if (*argv == NULL)
-			return false;
-	}
-
-	errno=0;
-	(*argv)[(*argc)++] = *str;
-	(*argv)[*argc] = (char *) NULL;
-	return true;
-}
-
-bool ccvar(char ***toargv, size_t *toargc, char **fromargv, size_t fromargc) {
-	size_t nc = (*toargc)+fromargc;
-
-	size_t nb = BINALLOC(sizeof(void*), nc+1);
-	size_t ob = BINALLOC(sizeof(void*), (*toargc)+1);
-	if (nb >= ob) {
-		if (*toargv == NULL)
-			*toargv = malloc(nb);
-		else
-			*toargv = realloc(*toargv, nb);
-		if (*toargv == NULL)
-			return false;
-	}
-
-	for (size_t l=0; *toargc < nc; (*toargc)++)
-		(*toargv)[*toargc] = fromargv[l++];
-
-	errno=0;
-	(*toargv)[*toargc] = (char *) NULL;
-	return true;
-}
-
-void passive_error(int verbose, const char* message) {
-	switch (errno) {
-		case 0: return;
-		// TODO: process fatal errors with more vigor, fatals always output.
-		case ENOMEM: case EHWPOISON: case ENOSPC:
-			error(1, errno, "Fatal: %s", message);
-		default:
-			if (verbose != 0)
-				error(0, errno, "Error: %s", message);
-			return;
-	}
+static int serve(int argc, const char **argv, int tty) {
+	served = true;
+	return run(argc, argv, tty);
 }
 
-// TODO: limit ramfile size to 128MiB; anything larger is unreasonable
-int main(int argc, const char** argv) {
+/**
+ * @description - Parses the command line and carries it out, locally or
+ *   through the daemon.
+ * @argument argc - argument count, including the program name
+ * @argument argv - arguments
+ * @argument tty - terminal for the editor, or zero for /dev/tty
+ * @return - the exit status.
+ */
+static int run(int argc, const char **argv, int tty) {
 	// int stream = 0;
 	int volat = 0;
 	int verbose = 0;
 	int show_version = 0;
 	int new_window = 0;
+	int release = 0;
+	int emit_on_save = 0;
+	const char *stats = NULL;
+	int stats_fd = 0;
+	int stats_record = 0;
+	int stats_report = 0;
+	int progress = 0;
+	const char *large_size = "0";
+	const char *large_lines = "0";
+	const char *large_line = "0";
+	const char *large_editor = NULL;
+	const char *binary_editor = NULL;
 	const char *frompath = NULL;
-	posix_spawn_file_actions_t fact;
-	FILE* safp = NULL;
-	int safd;
+	int null = 0;
+	int in_place = 0;
+	int each = 0;
+	const char *dir = NULL;
+	const char *separator = NULL;
+	int parallel = 0;
+	const char *replay = NULL;
+	const char *server = NULL;
+	const char *tee = NULL;
+	int daemon = 0;
+	int client = 0;
+	struct path_list tees = { 0 };
+	struct path_list froms = { 0 };
+
+	// Argparse reorders argv, keep the original to forward to the daemon.
+	int fargc = argc;
+	const char **fargv = xmemdup(argv, (argc + 1) * sizeof(char*));
 
 	/* clang-format off */
 	struct argparse_option options[] = {
@@ -367,10 +165,103 @@ int main(int argc, const char** argv) {
 			"Launches the EDITOR from a new terminal window.",
 			NULL, 0, 0
 		),
+		OPT_BOOLEAN('\0', "release", &release,
+			"Frees storage as it's written out, so a slow reader doesn't pin memory.",
+			NULL, 0, 0
+		),
+		OPT_BOOLEAN('\0', "emit-on-save", &emit_on_save,
+			"Write out every save while the editor is still open; only the new part of appends.",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "stats", &stats,
+			"Report time, faults and I/O per phase on exit, as `human` (the default) or `json`.",
+			NULL, 0, 0
+		),
+		OPT_INTEGER('\0', "stats-fd", &stats_fd,
+			"Write `--stats` to this fd instead of stderr.",
+			NULL, 0, 0
+		),
+		OPT_BOOLEAN('\0', "stats-record", &stats_record,
+			"Add this run's latencies to the histograms kept in XDG_STATE_HOME.",
+			NULL, 0, 0
+		),
+		OPT_BOOLEAN('\0', "stats-report", &stats_report,
+			"Print percentiles of every run recorded with `--stats-record` and exit.",
+			NULL, 0, 0
+		),
+		OPT_BOOLEAN('\0', "progress", &progress,
+			"Show bytes, rate and time taken while reading input and writing it out.",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "replay", &replay,
+			"How to write out storage: auto, rw, sendfile, splice, vmsplice or copy.",
+			NULL, 0, 0
+		),
+		OPT_INTEGER('\0', "parallel", &parallel,
+			"Run EDITOR as a filter on N slices of the input at once, split at newlines. "
+			"With `--each`, filter N files at once.",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "large-size", &large_size,
+			"Input this big or bigger is large, like 256M (default 0, no limit).",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "large-lines", &large_lines,
+			"Input with this many lines or more is large (default 0, no limit).",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "large-line", &large_line,
+			"Input with a line this long or longer is large, like 1M (default 0, no limit).",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "large-editor", &large_editor,
+			"Edit large input with this. Otherwise vim, nvim, nano and emacs skip their config.",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "binary-editor", &binary_editor,
+			"Edit input with NUL bytes or that isn't UTF-8 with this, like `hexedit`.",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "server", &server,
+			"Edit in the Neovim listening on this unix socket instead of spawning EDITOR.",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "tee", &tee,
+			"Also write the edited contents to PATH. May be repeated.",
+			&collect_path, (intptr_t) &tees, 0
+		),
+		OPT_BOOLEAN('\0', "daemon", &daemon,
+			"Stay resident and run requests from `--client` with a warm editor cache.",
+			NULL, 0, 0
+		),
+		OPT_BOOLEAN('\0', "client", &client,
+			"Hand this request to the running daemon, if there is one.",
+			NULL, 0, 0
+		),
 		// TODO: figure out how to require a value for this. May need to fork
 		//       the project and add that myself.
 		OPT_STRING('f', "from", &frompath,
-			"Read from FILE instead of stdin.",
+			"Read from FILE instead of stdin. Repeat to edit several files at once.",
+			&collect_path, (intptr_t) &froms, 0
+		),
+		OPT_BOOLEAN('0', "null", &null,
+			"Edit each NUL terminated record on stdin as its own file, all at once.",
+			NULL, 0, 0
+		),
+		OPT_BOOLEAN('\0', "in-place", &in_place,
+			"Write each `--from` FILE back over itself instead of to stdout.",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "separator", &separator,
+			"Write STR between the results of a batch on stdout.",
+			NULL, 0, 0
+		),
+		OPT_STRING('\0', "dir", &dir,
+			"Edit a listing of DIR: change a name to rename, delete a line to delete.",
+			NULL, 0, 0
+		),
+		OPT_BOOLEAN('\0', "each", &each,
+			"Filter every FILE in place with the editor after `--`, one per processor at once.",
 			NULL, 0, 0
 		),
 		OPT_END()
@@ -387,146 +278,150 @@ int main(int argc, const char** argv) {
 		NULL
 	);
 
+	// Argparse has no optional values; a bare `--stats` means human readable.
+	for (int l=1; l < argc && strcmp(argv[l], "--") != 0; l++)
+		if (strcmp(argv[l], "--stats") == 0) argv[l] = "--stats=human";
+
 	argc = argparse_parse(&argparse, argc, argv);
 
+	struct { const char *name, *arg; unsigned long long value; } limits[] = {
+		{ "--large-size", large_size }, { "--large-lines", large_lines },
+		{ "--large-line", large_line },
+	};
+	for (size_t l=0; l < sizeof(limits) / sizeof(*limits); l++)
+		if (parse_size(limits[l].arg, &limits[l].value) != 0) {
+			error(0, 0, "`%s` takes a count like 300M, not '%s'", limits[l].name, limits[l].arg);
+			free(fargv);
+			free(tees.paths);
+			free(froms.paths);
+			return 2;
+		}
 
-	// TODO: Do safety checks for these allocators
-	if (volat != 0) {
-		safd = memfd_create("ramfile", 0);
-	}
-	else {
-		safp = tmpfile();
-		safd = fileno(safp);
+	// `--each FILE... -- FILTER`: argparse drops the `--` but keeps the order,
+	// so whatever followed it in the original arguments is the filter.
+	const char **files = argv;
+	int nfiles = 0;
+	if (each != 0) {
+		int nfilter = 0;
+		for (int l=1; l < fargc; l++)
+			if (strcmp(fargv[l], "--") == 0) {
+				nfilter = fargc - l - 1;
+				break;
+			}
+		nfiles = argc - nfilter;
+		argv += nfiles;
+		argc = nfilter;
 	}
 
-	very_simple_cat("Writing input to storage area", STDIN_FILENO, safd);
-
-
-	// `/proc/$$/fd/$FD`  8 + log10(! pid_t) + log10(! int)
-	char *filename;
-	size_t fnamelen = 8 + floor(log10(!((pid_t) 0))) + floor(log10(!((int) 0)));
-	filename = malloc(fnamelen * sizeof(char) + sizeof(char)); // + null char
-	filename[fnamelen] = '\0';
-
-	// NOTE: linux pid_t is signed int so this should be safe.
-	sprintf(filename, "/proc/%d/fd/%d", getpid(), safd);
-
-	{
-		pid_t child = -1; int status;
-		char **cargv = NULL; size_t cargc = 0;
-		char *window = NULL;
-		char *editor = NULL;
-		int l = 0;
+	struct mvipe_options opts = {
+		.verbose = verbose,
+		.volat = volat,
+		.new_window = new_window,
+		.release = release,
+		.emit_on_save = emit_on_save,
+		.stats = stats,
+		.stats_fd = stats_fd,
+		.stats_record = stats_record,
+		.progress = progress,
+		.large_size = limits[0].value,
+		.large_lines = limits[1].value,
+		.large_line = limits[2].value,
+		.large_editor = large_editor,
+		.binary_editor = binary_editor,
+		.replay = replay,
+		.server = server,
+		.parallel = parallel > 0 ? (unsigned) parallel : 0,
+		.tees = tees.paths,
+		.ntees = tees.count,
+		.argc = argc,
+		.argv = argv,
+	};
 
-		void memsafety() {
-			free(cargv);
-			free(window);
-			free(editor);
-			free(filename);
+	int status = -1;
+	// Only the daemon and its clients need the socket.
+	char *path = daemon != 0 || client != 0 ? daemon_socket_path() : NULL;
+	if (stats_report != 0) {
+		status = mvipe_stats_report(STDOUT_FILENO);
+		if (status != 0) error(0, errno, "%s", mvipe_strerror());
+	}
+	else if (daemon != 0 && (served || path == NULL)) {
+		error(0, 0, served ? "Daemons can't be started by a client"
+			: "Daemon needs XDG_RUNTIME_DIR to be set");
+		status = 1;
+	}
+	else if (daemon != 0) {
+		served_argc = argc;
+		served_argv = argv;
+		// Resolve the editor this daemon will usually be asked for up front, so
+		// every client starts from a warm cache.
+		if (mvipe_prepare(&opts) != 0 && verbose != 0)
+			error(0, errno, "Error: %s", mvipe_strerror());
+		status = daemon_serve(path, &serve);
+	}
+	else if (client != 0 && served != true && path != NULL)
+		status = daemon_client(path, fargc, fargv);
+
+	// No daemon listening is the same as not asking for one.
+	if (status < 0) {
+		opts.tty = tty;
+		if (served && opts.argc == 0) {
+			opts.argc = served_argc;
+			opts.argv = served_argv;
 		}
 
-		atexit(&memsafety);
-
-		// Preset errno to zero as it's basically a non-error and we can use it
-		// to check for error throws.
-		errno = 0;
-
-		posix_spawn_file_actions_init(&fact);
-
-		/* NOTE:
-		 *  Struggling to figure out what we need to do to determine the user's preffered
-		 *  Terminal emulator. It seems to be different on every Linux distro. The program
-		 *  targeted by TERM isn't even guaranteed to exist...
-		 *  SOOOOO I'm gonna do a compat move for Debian
-		 *  based distros. Try `$TERM`, then `x-terminal-emulator`. Could also query the
-		 *  display environment like GTK, Gnome, KDE so on and so forth.
-		 *  GTK: gsettings get org.gnome.desktop.default-applications.terminal exec
-		 *       gsettings get org.gnome.desktop.default-applications.terminal exec-arg
-		 */
-		if (new_window != 0) {
-			char *winopts[2]; l=0;
-			winopts[0] = getenv("TERM");
-			winopts[1] = "x-terminal-emulator";
-			do {
-				if (winopts[l] == NULL) continue;
-				passive_error(verbose, window);
-				errno = 0;
-				free(window);
-				window = strdup(winopts[l++]);
-			}
-			while (shexpaccvar(&window, &cargv, &cargc) != true && l < 2);
-			if (errno != 0) error(1, errno, "Couldn't establish a suitable terminal");
+		struct batch batch = {
+			.from = froms.paths,
+			.nfrom = froms.count,
+			.null = null != 0,
+			.in_place = in_place != 0,
+			.separator = separator,
+		};
+		int infd = STDIN_FILENO;
+		if (dir != NULL && (each != 0 || froms.count != 0 || null != 0 || in_place != 0 || parallel > 1)) {
+			error(0, 0, "`--dir` edits a directory, it can't be combined with other inputs");
+			status = 1;
 		}
-		else {
-			// If we're preserving the terminal and not using an alt window, ensure
-			// we actually inherit the TTY. But we don't need this when we're using
-			// a new window.
-			// Open only fd 0 and 1 to TTY, we want to inherit stderr
-			posix_spawn_file_actions_addopen(&fact, 0, "/dev/tty", O_RDWR, (mode_t) 0);
-			posix_spawn_file_actions_adddup2(&fact, 0, 1);
+		else if (dir != NULL)
+			status = dir_run(&opts, dir);
+		else if (each != 0 && (froms.count != 0 || null != 0 || in_place != 0 || new_window != 0)) {
+			error(0, 0, "`--each` filters its own FILEs, it can't be combined with other inputs");
+			status = 1;
 		}
-
-		if (argc != 0) {
-			editor = strdup(argv[0]);
-			if (shpaccvar(&editor, &cargv, &cargc) != true)
-				error(127, errno, "Editor unavailable");
-
-			if (ccvar(&cargv, &cargc, argv+sizeof(void*), argc-1) != true)
-				error(1, errno, "Couldn't rellocate arguments");
+		else if (each != 0)
+			status = each_run(&opts, files, (size_t) nfiles, opts.parallel);
+		else if (null != 0 && froms.count != 0) {
+			error(0, 0, "`--null` splits stdin, it can't be used with `--from`");
+			status = 1;
 		}
-		else {
-			char *editopts[5]; l=0;
-			// For implementation considerations see:
-			//   https://unix.stackexchange.com/questions/316856
-			editopts[0] = "sensible-editor"; // Try Debian-alikes first
-			editopts[1] = getenv("VISUAL"); // Then in order of user friendlyness
-			editopts[2] = getenv("EDITOR");
-			editopts[3] = "nano";
-			editopts[4] = "vi";
-			do {
-				if (editopts[l] == NULL) continue;
-				passive_error(verbose, editor);
-				errno = 0;
-				free(editor);
-				editor = strdup(editopts[l]);
-			}
-			while (shexpaccvar(&editor, &cargv, &cargc) != true && l++ < 5);
-			if (errno) error(127, errno, "Editor unavailable");
+		else if (parallel > 1 && (froms.count > 1 || null != 0 || in_place != 0)) {
+			error(0, 0, "`--parallel` splits a single input, it can't be used in a batch");
+			status = 1;
 		}
-
-		if (pushvar(&filename, &cargv, &cargc) != true)
-			error(1, errno, "Couldn't append required storage area argument.");
-
-		// NOTE: execv convention makes argument 0 a redundant copy of the
-		//   `program` argument; shifting the array will always ignore the first
-		//   entry in the supplied variadic list.
-		if (errno = posix_spawn(&child, cargv[0], &fact, 0, cargv, environ) != 0)
-			error(1, errno, "Failed to execute");
-
-
-		await:
-		waitpid(child, &status, WCONTINUED);
-		if (WIFEXITED(status) != 0) {
-			if (verbose != 0) fprintf(stderr, "Info: Child exited normally.\n");
+		else if (in_place != 0 && froms.count == 0) {
+			error(0, 0, "`--in-place` needs at least one `--from` FILE");
+			status = 1;
 		}
-		else if (WIFSTOPPED(status) != 0) {
-			fprintf(stderr, "Info: Child stopped, waiting for it to continue.\n");
-			goto await;
-		}
-		else if (WIFCONTINUED(status) != 0) {
-			fprintf(stderr, "Info: Child continued, waiting for valid termination.\n");
-			goto await;
+		else if (froms.count > 1 || null != 0 || in_place != 0)
+			status = batch_run(&opts, &batch);
+		else if (froms.count == 1 && (infd = open(froms.paths[0], O_RDONLY | O_CLOEXEC)) < 0) {
+			error(0, errno, "Couldn't open '%s'", froms.paths[0]);
+			status = 1;
 		}
 		else {
-			switch(WEXITSTATUS(status)) {
-				// TODO: specialize error reporting
-				default: exit(1);
-			}
+			status = mvipe_run(&opts, infd, STDOUT_FILENO);
+			if (status != 0) error(0, errno, "%s", mvipe_strerror());
+			if (infd != STDIN_FILENO) close(infd);
 		}
 	}
 
-	lseek(safd, 0, SEEK_SET);
-	very_simple_cat("Writing modified contents to stdout", safd, STDOUT_FILENO);
+	free(path);
+	free(fargv);
+	free(tees.paths);
+	free(froms.paths);
+	return status;
+}
 
-	return 0;
+// TODO: limit ramfile size to 128MiB; anything larger is unreasonable
+int main(int argc, const char** argv) {
+	return run(argc, argv, 0);
 }
@@ -0,0 +1,387 @@
+// Differential tests of every capture and replay backend against the
+// reference copy loop, plus a benchmark of each in the same run.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <munit.h>
+#include <theft.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include <internal.h>
+#include "test.h"
+
+
+/* NOTE:
+ *  Each trial pushes the same generated input through `very_simple_cat`
+ *  and through a whole `mvipe_run` session with `true` as the editor, then
+ *  demands identical output. Theft picks everything that tends to shake out
+ *  bugs in copy loops: the size, how much the producer writes and the
+ *  consumer reads at once (so every read and write comes up short), both
+ *  pipes' capacities, a producer that dawdles, and a thread that keeps
+ *  interrupting the session's syscalls with a signal, for EINTR. Failures
+ *  shrink to the smallest such setup and print it.
+ *
+ *  Every test runs once per replay backend, storage area, sink type and
+ *  release mode; the benchmark only per backend and storage area, on a
+ *  64 MiB input. MVIPE_TEST_TRIALS sets the trials per test (default 30);
+ *  `--seed` repeats a run exactly.
+ */
+
+#define BENCH_SIZE (64u << 20)
+
+struct trial {
+	uint32_t size;
+	uint32_t seed; // For the contents and the chunk sizes.
+	uint32_t chunk; // Most the producer writes at once.
+	uint32_t gulp; // Most the consumer reads at once.
+	uint32_t cap_in, cap_out; // Pipe capacities.
+	bool dawdle; // Producer yields between chunks.
+	bool eintr;
+};
+
+struct env {
+	struct mvipe_options opts;
+	const char *editor[1];
+	bool file_sink;
+};
+
+typedef int copier(int infd, int outfd, void *ctx);
+
+static uint32_t xorshift(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+	return *state = x != 0 ? x : 0x9e3779b9;
+}
+
+static enum theft_alloc_res trial_alloc(struct theft *t, void *env, void **instance) {
+	struct trial *tr = xmalloc(sizeof(*tr));
+	// Picking the magnitude first favours small inputs, and shrinks well.
+	uint8_t bits = (uint8_t) theft_random_choice(t, 21);
+	tr->size = bits != 0 ? (uint32_t) theft_random_bits(t, bits) : 0;
+	tr->seed = (uint32_t) theft_random_bits(t, 32);
+	tr->chunk = 1 + (uint32_t) theft_random_bits(t, (uint8_t) (1 + theft_random_choice(t, 17)));
+	tr->gulp = 1 + (uint32_t) theft_random_bits(t, (uint8_t) (1 + theft_random_choice(t, 17)));
+	// 4 KiB to 1 MiB, which is as big as an unprivileged pipe gets.
+	tr->cap_in = 4096u << theft_random_choice(t, 9);
+	tr->cap_out = 4096u << theft_random_choice(t, 9);
+	tr->dawdle = theft_random_bits(t, 1) != 0;
+	tr->eintr = theft_random_bits(t, 1) != 0;
+	*instance = tr;
+	return THEFT_ALLOC_OK;
+}
+
+static void trial_print(FILE *f, const void *instance, void *env) {
+	const struct trial *tr = instance;
+	fprintf(f, "size %u, seed %#x, chunks of <= %u, reads of <= %u, pipes %u/%u%s%s",
+		tr->size, tr->seed, tr->chunk, tr->gulp, tr->cap_in, tr->cap_out,
+		tr->dawdle ? ", dawdling" : "", tr->eintr ? ", interrupted" : "");
+}
+
+static const struct theft_type_info trial_info = {
+	.alloc = &trial_alloc,
+	.free = &theft_generic_free_cb,
+	.print = &trial_print,
+	.autoshrink_config = { .enable = true },
+};
+
+struct producer {
+	const struct trial *tr;
+	const char *data;
+	int fd;
+};
+
+static void *produce(void *arg) {
+	struct producer *p = arg;
+	uint32_t rng = p->tr->seed ^ 0x5bd1e995;
+	size_t at = 0;
+
+	while (at < p->tr->size) {
+		size_t n = 1 + xorshift(&rng) % p->tr->chunk;
+		if (n > p->tr->size - at) n = p->tr->size - at;
+		ssize_t put = write(p->fd, p->data + at, n);
+		if (put < 0 && errno == EINTR) continue;
+		if (put < 0) break; // The session gave up; it'll say why.
+		at += (size_t) put;
+		if (p->tr->dawdle) sched_yield();
+	}
+	close(p->fd);
+	return NULL;
+}
+
+struct consumer {
+	const struct trial *tr;
+	int fd;
+	char *got;
+	size_t ngot, cap;
+};
+
+static void *consume(void *arg) {
+	struct consumer *c = arg;
+	uint32_t rng = c->tr->seed ^ 0x27d4eb2f;
+
+	while (true) {
+		size_t n = 1 + xorshift(&rng) % c->tr->gulp;
+		if (c->ngot + n > c->cap) {
+			c->cap = (c->ngot + n) * 2;
+			c->got = xrealloc(c->got, c->cap);
+		}
+		ssize_t got = read(c->fd, c->got + c->ngot, n);
+		if (got < 0 && errno == EINTR) continue;
+		if (got <= 0) break;
+		c->ngot += (size_t) got;
+	}
+	return NULL;
+}
+
+struct pest {
+	pthread_t target;
+	atomic_bool stop;
+};
+
+static void *pester(void *arg) {
+	struct pest *p = arg;
+	const struct timespec pause = { .tv_nsec = 50 * 1000 };
+	while (atomic_load(&p->stop) != true) {
+		pthread_kill(p->target, SIGUSR1);
+		nanosleep(&pause, NULL);
+	}
+	return NULL;
+}
+
+static void on_usr1(int sig) {
+	(void) sig;
+}
+
+static void fill(char *data, const struct trial *tr) {
+	uint32_t rng = tr->seed;
+	for (size_t l=0; l < tr->size; l++) data[l] = (char) xorshift(&rng);
+}
+
+/**
+ * @description - Runs one copier between two fresh pipes shaped by the
+ *   trial, or into a temporary file with `file_sink`.
+ * @return - the copier's result; out holds whatever came out either way.
+ */
+static int pipeline(const struct trial *tr, const char *data, copier *copy, void *ctx,
+		bool file_sink, char **out, size_t *nout) {
+	struct producer p = { .tr = tr, .data = data };
+	struct consumer c = { .tr = tr };
+	struct pest pest = { .target = pthread_self() };
+	pthread_t producer, consumer, pesterer;
+	int in[2], outp[2] = { -1, -1 }, sink;
+
+	if (pipe2(in, O_CLOEXEC) != 0) return -1;
+	fcntl(in[1], F_SETPIPE_SZ, (int) tr->cap_in);
+	if (file_sink) {
+		char path[] = "/tmp/m-vipe-test-XXXXXX";
+		sink = mkostemp(path, O_CLOEXEC);
+		unlink(path);
+	}
+	else {
+		if (pipe2(outp, O_CLOEXEC) != 0) return -1;
+		fcntl(outp[0], F_SETPIPE_SZ, (int) tr->cap_out);
+		sink = outp[1];
+		c.fd = outp[0];
+		pthread_create(&consumer, NULL, &consume, &c);
+	}
+	p.fd = in[1];
+	pthread_create(&producer, NULL, &produce, &p);
+	atomic_init(&pest.stop, false);
+	if (tr->eintr) pthread_create(&pesterer, NULL, &pester, &pest);
+
+	int res = copy(in[0], sink, ctx);
+
+	if (tr->eintr) {
+		atomic_store(&pest.stop, true);
+		pthread_join(pesterer, NULL);
+	}
+	// Unblocks a producer the copier stopped listening to.
+	close(in[0]);
+	pthread_join(producer, NULL);
+	if (file_sink) {
+		struct stat stat_buf;
+		fstat(sink, &stat_buf);
+		c.ngot = (size_t) stat_buf.st_size;
+		c.got = xmalloc(c.ngot + 1);
+		if (pread(sink, c.got, c.ngot, 0) != (ssize_t) c.ngot) res = -1;
+		close(sink);
+	}
+	else {
+		close(sink);
+		pthread_join(consumer, NULL);
+		close(outp[0]);
+	}
+	*out = c.got;
+	*nout = c.ngot;
+	return res;
+}
+
+static int copy_reference(int infd, int outfd, void *ctx) {
+	(void) ctx;
+	return very_simple_cat(infd, outfd, NULL);
+}
+
+static int copy_session(int infd, int outfd, void *ctx) {
+	return mvipe_run(ctx, infd, outfd);
+}
+
+static enum theft_trial_res prop_equivalent(struct theft *t, void *arg) {
+	const struct trial *tr = arg;
+	struct env *env = theft_hook_get_env(t);
+	char *data = xmalloc(tr->size + 1), *want, *got;
+	size_t nwant, ngot;
+	enum theft_trial_res res = THEFT_TRIAL_PASS;
+
+	fill(data, tr);
+	int ref = pipeline(tr, data, &copy_reference, NULL, env->file_sink, &want, &nwant);
+	int ses = pipeline(tr, data, &copy_session, &env->opts, env->file_sink, &got, &ngot);
+	if (ref != 0 || nwant != tr->size || memcmp(want, data, nwant) != 0) {
+		fprintf(stderr, "reference copy failed: %d, %zu of %u bytes\n", ref, nwant, tr->size);
+		res = THEFT_TRIAL_ERROR;
+	}
+	else if (ses != 0) {
+		fprintf(stderr, "session failed: %s\n", mvipe_strerror());
+		res = THEFT_TRIAL_FAIL;
+	}
+	else if (ngot != nwant || memcmp(got, want, ngot) != 0)
+		res = THEFT_TRIAL_FAIL;
+
+	free(data);
+	free(want);
+	free(got);
+	return res;
+}
+
+static void env_setup(struct env *env, const MunitParameter params[]) {
+	const char *sink = munit_parameters_get(params, "sink");
+	memset(env, 0, sizeof(*env));
+	env->editor[0] = "true";
+	env->opts.argc = 1;
+	env->opts.argv = env->editor;
+	// Anything but a terminal: the editor has nothing to show.
+	env->opts.tty = open("/dev/null", O_RDWR | O_CLOEXEC);
+	env->opts.replay = munit_parameters_get(params, "replay");
+	env->opts.volat = strcmp(munit_parameters_get(params, "storage"), "memfd") == 0;
+	const char *release = munit_parameters_get(params, "release");
+	env->opts.release = release != NULL && strcmp(release, "yes") == 0;
+	// `copy` only ever writes to regular files; elsewhere it's plain rw.
+	env->file_sink = sink != NULL ? strcmp(sink, "file") == 0
+		: strcmp(env->opts.replay, "copy") == 0;
+
+	// No SA_RESTART, so the pester thread's signal interrupts for real.
+	struct sigaction sa = { .sa_handler = &on_usr1 };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+}
+
+static MunitResult test_equivalent(const MunitParameter params[], void *data) {
+	struct env env;
+	const char *trials = getenv("MVIPE_TEST_TRIALS");
+	(void) data;
+
+	env_setup(&env, params);
+	struct theft_run_config config = {
+		.name = "replay matches the reference copy",
+		.prop1 = &prop_equivalent,
+		.type_info = { &trial_info },
+		.trials = trials != NULL ? (size_t) strtoul(trials, NULL, 10) : 30,
+		// From munit's generator, so `--seed` repeats everything.
+		.seed = ((uint64_t) munit_rand_uint32() << 32) | munit_rand_uint32(),
+		.hooks = { .env = &env },
+	};
+	enum theft_run_res res = theft_run(&config);
+	close(env.opts.tty);
+	return res == THEFT_RUN_PASS ? MUNIT_OK : MUNIT_FAIL;
+}
+
+static double seconds_since(const struct timespec *t0) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) (now.tv_sec - t0->tv_sec) + (double) (now.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/**
+ * @description - Times the reference loop and the session on the same
+ *   large input, best of three, checking every result as it goes.
+ */
+static MunitResult test_bench(const MunitParameter params[], void *data) {
+	struct env env;
+	const struct trial tr = {
+		.size = BENCH_SIZE, .seed = 0x6d766970, .chunk = 1 << 16, .gulp = 1 << 16,
+		.cap_in = 1 << 16, .cap_out = 1 << 16,
+	};
+	double best[2] = { 1e9, 1e9 };
+	(void) data;
+
+	env_setup(&env, params);
+	char *input = xmalloc(tr.size);
+	fill(input, &tr);
+	for (int run=0; run < 3; run++)
+		for (int which=0; which < 2; which++) {
+			struct timespec t0;
+			char *out;
+			size_t nout;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			int res = which == 0
+				? pipeline(&tr, input, &copy_reference, NULL, env.file_sink, &out, &nout)
+				: pipeline(&tr, input, &copy_session, &env.opts, env.file_sink, &out, &nout);
+			double took = seconds_since(&t0);
+			munit_assert_int(res, ==, 0);
+			munit_assert_size(nout, ==, tr.size);
+			munit_assert_memory_equal(nout, out, input);
+			free(out);
+			if (took < best[which]) best[which] = took;
+		}
+	munit_logf(MUNIT_LOG_INFO, "reference %.1f MiB/s, session %.1f MiB/s",
+		tr.size / best[0] / (1 << 20), tr.size / best[1] / (1 << 20));
+	free(input);
+	close(env.opts.tty);
+	return MUNIT_OK;
+}
+
+static char *replays[] = { "auto", "rw", "sendfile", "splice", "vmsplice", "copy", NULL };
+static char *storages[] = { "file", "memfd", NULL };
+static char *sinks[] = { "pipe", "file", NULL };
+static char *releases[] = { "no", "yes", NULL };
+
+static MunitParameterEnum params[] = {
+	{ "replay", replays },
+	{ "storage", storages },
+	{ "sink", sinks },
+	{ "release", releases },
+	{ NULL, NULL },
+};
+
+// Release mode and the sink type barely move the numbers; keep it short.
+static MunitParameterEnum bench_params[] = {
+	{ "replay", replays },
+	{ "storage", storages },
+	{ NULL, NULL },
+};
+
+static MunitTest tests[] = {
+	{ "/equivalent", &test_equivalent, NULL, NULL, MUNIT_TEST_OPTION_NONE, params },
+	{ "/bench", &test_bench, NULL, NULL, MUNIT_TEST_OPTION_NONE, bench_params },
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+};
+
+const MunitSuite backends_suite = { "/backends", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE };
@@ -0,0 +1,370 @@
+// End-to-end benchmarks: throughput and time to editor across input sizes,
+// stdin types, storage areas and replay backends.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <time.h>
+#include <signal.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+#include <argparse.h>
+
+
+/* NOTE:
+ *  Every case runs the real m-vipe in its own session, with a fresh pty as
+ *  its controlling terminal, so it behaves exactly as it would for a person
+ *  and still runs unattended. The editor is m-vipe-fake-editor, which notes
+ *  when it started; time to editor is measured from just before the fork.
+ *  Wall time runs until m-vipe has exited and all of its output was read.
+ *
+ *  Sizes go up by eights from 1 KiB to --max-size, which is also always
+ *  run. Terminals are only fed up to 16 MiB, nobody types more than that.
+ *  The `copy` backend only applies to regular files, so its output goes to
+ *  a file; everything else writes into a pipe.
+ */
+
+static const char *const usage[] = {
+	"m-vipe-bench [--max-size=SIZE] [--runs=N] [--format=csv|json] [options]",
+	NULL,
+};
+
+#define TTY_MAX (16LL << 20)
+
+struct bench {
+	const char *bin;
+	const char *editor;
+	const char *transform;
+	const char *label;
+	const char *tmpdir;
+	bool json;
+	int runs;
+	size_t rows;
+};
+
+struct result {
+	double wall; // Seconds, median.
+	double to_editor; // Seconds, median.
+	long long out; // Bytes written out by the last run.
+	bool ok;
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static int double_cmp(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static long long parse_size(const char *str) {
+	char *end;
+	long long size = strtoll(str, &end, 10);
+	switch (*end) {
+		case 'G': case 'g': size <<= 10; // fall through
+		case 'M': case 'm': size <<= 10; // fall through
+		case 'K': case 'k': size <<= 10; end++; break;
+	}
+	if (*end != '\0' && strcmp(end, "iB") != 0 && strcmp(end, "B") != 0)
+		error(2, 0, "Bad size '%s'", str);
+	return size;
+}
+
+/**
+ * @description - Writes size bytes of 64 byte lines to fd. With `tty`, ends
+ *   with the EOF character, twice when the last line is unterminated.
+ * @return - zero on success, -1 with errno set otherwise.
+ */
+static int feed(int fd, long long size, bool tty) {
+	static char block[1 << 16];
+	if (block[0] == '\0') {
+		for (size_t l=0; l < sizeof(block); l += 64) {
+			snprintf(block + l, 64, "%08zx the quick brown fox jumps over the lazy dog 0123456789",
+				l / 64);
+			block[l + 63] = '\n';
+		}
+	}
+
+	for (long long left = size; left > 0;) {
+		size_t n = left < (long long) sizeof(block) ? (size_t) left : sizeof(block);
+		if (full_write(fd, block, n) != n) return -1;
+		left -= (long long) n;
+	}
+	if (tty) {
+		const char eof[] = "\004\004";
+		size_t n = size % 64 != 0 ? 2 : 1;
+		if (full_write(fd, eof, n) != n) return -1;
+	}
+	return 0;
+}
+
+static long long expected_size(const struct bench *b, long long size) {
+	if (strcmp(b->transform, "noop") == 0) return size;
+	if (strncmp(b->transform, "append=", 7) == 0) return size + (long long) strlen(b->transform + 7);
+	if (strncmp(b->transform, "truncate=", 9) == 0) {
+		long long cut = strtoll(b->transform + 9, NULL, 10);
+		return cut < size ? cut : size;
+	}
+	return -1; // Depends on the data; only the exit status is checked.
+}
+
+/**
+ * @description - Runs m-vipe once.
+ * @argument input - a file holding the input, for the `file` stdin type
+ * @return - true when it succeeded with the expected output.
+ */
+static bool run_once(const struct bench *b, const char *type, const char *storage,
+		const char *replay, long long size, const char *input, double *wall,
+		double *to_editor, long long *out) {
+	char stamp[4096], sink[4096];
+	snprintf(stamp, sizeof(stamp), "%s/m-vipe-bench-stamp-XXXXXX", b->tmpdir);
+	snprintf(sink, sizeof(sink), "%s/m-vipe-bench-out-XXXXXX", b->tmpdir);
+	int stampfd = mkstemp(stamp);
+	if (stampfd < 0) error(1, errno, "Couldn't create '%s'", stamp);
+	close(stampfd);
+
+	int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+		error(1, errno, "Couldn't open a pty");
+	char *slave = xstrdup(ptsname(master));
+	// Without echo, nothing piles up on the master side for us to drain.
+	struct termios tio;
+	int pts = open(slave, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (pts < 0 || tcgetattr(pts, &tio) != 0) error(1, errno, "Couldn't set up '%s'", slave);
+	tio.c_lflag &= ~(tcflag_t) ECHO;
+	tcsetattr(pts, TCSANOW, &tio);
+	close(pts);
+
+	int in[2] = { -1, -1 }, outp[2] = { -1, -1 }, outfd;
+	bool to_file = strcmp(replay, "copy") == 0;
+	if (strcmp(type, "pipe") == 0 && pipe2(in, O_CLOEXEC) != 0)
+		error(1, errno, "Couldn't create a pipe");
+	if (to_file) {
+		outfd = mkostemp(sink, O_CLOEXEC);
+		if (outfd < 0) error(1, errno, "Couldn't create '%s'", sink);
+		unlink(sink);
+	}
+	else {
+		if (pipe2(outp, O_CLOEXEC) != 0) error(1, errno, "Couldn't create a pipe");
+		outfd = outp[1];
+	}
+
+	char replayarg[64];
+	snprintf(replayarg, sizeof(replayarg), "--replay=%s", replay);
+	const char *argv[] = { b->bin, replayarg, "--", b->editor, b->transform, NULL, NULL };
+	if (strcmp(storage, "memfd") == 0) {
+		memmove(argv + 2, argv + 1, 4 * sizeof(char*));
+		argv[1] = "-V";
+	}
+
+	double t0 = now();
+	pid_t pid = fork();
+	if (pid < 0) error(1, errno, "Couldn't fork");
+	if (pid == 0) {
+		// A session of its own with the pty as its terminal, for /dev/tty.
+		setsid();
+		int tty = open(slave, O_RDWR);
+		if (tty < 0) _exit(126);
+		int infd = strcmp(type, "tty") == 0 ? tty
+			: strcmp(type, "pipe") == 0 ? in[0] : open(input, O_RDONLY);
+		if (infd < 0 || dup2(infd, 0) < 0 || dup2(outfd, 1) < 0) _exit(126);
+		setenv("MVIPE_BENCH_STAMP", stamp, 1);
+		execv(b->bin, (char **) argv);
+		_exit(127);
+	}
+
+	// Whoever is feeding keeps going while this side drains the output.
+	pid_t feeder = -1;
+	if (strcmp(type, "file") != 0) {
+		feeder = fork();
+		if (feeder < 0) error(1, errno, "Couldn't fork");
+		if (feeder == 0) _exit(feed(strcmp(type, "tty") == 0 ? master : in[1], size,
+			strcmp(type, "tty") == 0) != 0);
+	}
+	if (in[0] >= 0) { close(in[0]); close(in[1]); }
+
+	*out = 0;
+	if (to_file != true) {
+		static char buf[1 << 16];
+		ssize_t n;
+		close(outp[1]);
+		while ((n = read(outp[0], buf, sizeof(buf))) != 0) {
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) error(1, errno, "Reading output");
+			*out += n;
+		}
+		close(outp[0]);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+	*wall = now() - t0;
+	if (to_file) {
+		struct stat stat_buf;
+		if (fstat(outfd, &stat_buf) == 0) *out = stat_buf.st_size;
+		close(outfd);
+	}
+	if (feeder > 0) {
+		// A feeder can only be left blocked when m-vipe failed early.
+		kill(feeder, SIGKILL);
+		waitpid(feeder, NULL, 0);
+	}
+	close(master);
+	free(slave);
+
+	long long ns = 0;
+	FILE *sf = fopen(stamp, "r");
+	bool stamped = sf != NULL && fscanf(sf, "%lld", &ns) == 1;
+	if (sf != NULL) fclose(sf);
+	unlink(stamp);
+	*to_editor = stamped ? (double) ns / 1e9 - t0 : -1;
+
+	long long want = expected_size(b, size);
+	return stamped && WIFEXITED(status) && WEXITSTATUS(status) == 0
+		&& (want < 0 || want == *out);
+}
+
+static void report(struct bench *b, long long size, const char *type, const char *storage,
+		const char *replay, const struct result *r) {
+	double mib = r->wall > 0 ? (double) size / r->wall / (1 << 20) : 0;
+	if (b->json) {
+		printf("%s{\"label\":\"%s\",\"size\":%lld,\"stdin\":\"%s\",\"storage\":\"%s\","
+			"\"replay\":\"%s\",\"transform\":\"%s\",\"runs\":%d,\"wall_ms\":%.3f,"
+			"\"to_editor_ms\":%.3f,\"mib_per_s\":%.3f,\"bytes_out\":%lld,\"ok\":%s}",
+			b->rows != 0 ? ",\n " : "", b->label, size, type, storage, replay, b->transform,
+			b->runs, r->wall * 1e3, r->to_editor * 1e3, mib, r->out, r->ok ? "true" : "false");
+	}
+	else {
+		if (b->rows == 0)
+			printf("label,size,stdin,storage,replay,transform,runs,wall_ms,to_editor_ms,"
+				"mib_per_s,bytes_out,ok\n");
+		printf("%s,%lld,%s,%s,%s,\"%s\",%d,%.3f,%.3f,%.3f,%lld,%s\n", b->label, size, type,
+			storage, replay, b->transform, b->runs, r->wall * 1e3, r->to_editor * 1e3, mib,
+			r->out, r->ok ? "true" : "false");
+	}
+	fflush(stdout);
+	b->rows++;
+}
+
+// Splits a comma separated list in place.
+static size_t split(char *list, const char **items, size_t max) {
+	size_t n = 0;
+	for (char *tok = strtok(list, ","); tok != NULL && n < max; tok = strtok(NULL, ","))
+		items[n++] = tok;
+	return n;
+}
+
+int main(int argc, const char **argv) {
+	struct bench b = {
+		.bin = MVIPE_BENCH_BIN,
+		.editor = MVIPE_BENCH_EDITOR,
+		.transform = "noop",
+		.label = "",
+		.runs = 3,
+	};
+	const char *max_size = "64M";
+	const char *format = "csv";
+	char *types = xstrdup("pipe,file,tty");
+	char *storages = xstrdup("file,memfd");
+	char *replays = xstrdup("auto,rw,sendfile,splice,vmsplice,copy");
+	char *typesarg = NULL, *storagesarg = NULL, *replaysarg = NULL;
+
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_STRING('\0', "max-size", &max_size,
+			"Largest input, with an optional K, M or G suffix (default 64M, up to 8G and beyond).",
+			NULL, 0, 0),
+		OPT_INTEGER('\0', "runs", &b.runs, "Runs per case; the median is reported (default 3).",
+			NULL, 0, 0),
+		OPT_STRING('\0', "format", &format, "csv (the default) or json.", NULL, 0, 0),
+		OPT_STRING('\0', "transform", &b.transform,
+			"What the fake editor does: noop, append=TEXT, replace=RE=TEXT or truncate=N.",
+			NULL, 0, 0),
+		OPT_STRING('\0', "stdin", &typesarg, "Comma separated stdin types: pipe, file, tty.",
+			NULL, 0, 0),
+		OPT_STRING('\0', "storage", &storagesarg, "Comma separated storage areas: file, memfd.",
+			NULL, 0, 0),
+		OPT_STRING('\0', "replay", &replaysarg, "Comma separated replay backends.", NULL, 0, 0),
+		OPT_STRING('\0', "label", &b.label,
+			"Put in every row, to tell commits apart when comparing (a commit id, say).",
+			NULL, 0, 0),
+		OPT_STRING('\0', "bin", &b.bin, "The m-vipe to measure.", NULL, 0, 0),
+		OPT_STRING('\0', "editor", &b.editor, "The fake editor to run.", NULL, 0, 0),
+		OPT_END(),
+	};
+	struct argparse argparse;
+	argparse_init(&argparse, options, usage, 0);
+	argparse_parse(&argparse, argc, argv);
+
+	if (typesarg != NULL) { free(types); types = xstrdup(typesarg); }
+	if (storagesarg != NULL) { free(storages); storages = xstrdup(storagesarg); }
+	if (replaysarg != NULL) { free(replays); replays = xstrdup(replaysarg); }
+	if (b.runs < 1) error(2, 0, "Need at least one run");
+	if (strcmp(format, "json") != 0 && strcmp(format, "csv") != 0)
+		error(2, 0, "Unknown format '%s'", format);
+	b.json = strcmp(format, "json") == 0;
+	b.tmpdir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+
+	const char *type[8], *storage[8], *replay[16];
+	size_t ntypes = split(types, type, 8);
+	size_t nstorages = split(storages, storage, 8);
+	size_t nreplays = split(replays, replay, 16);
+	long long max = parse_size(max_size);
+	double *walls = xcalloc((size_t) b.runs, sizeof(double));
+	double *waits = xcalloc((size_t) b.runs, sizeof(double));
+
+	if (b.json) printf("[");
+	for (long long size = 1024; size <= max; size = size < max && size * 8 > max ? max : size * 8) {
+		// One input file per size, shared by every case that reads a file.
+		char input[4096];
+		snprintf(input, sizeof(input), "%s/m-vipe-bench-in-XXXXXX", b.tmpdir);
+		int infd = mkstemp(input);
+		if (infd < 0 || feed(infd, size, false) != 0)
+			error(1, errno, "Couldn't create a %lld byte input", size);
+		close(infd);
+
+		for (size_t t=0; t < ntypes; t++) {
+			if (strcmp(type[t], "tty") == 0 && size > TTY_MAX) continue;
+			for (size_t s=0; s < nstorages; s++)
+				for (size_t r=0; r < nreplays; r++) {
+					struct result res = { .ok = true };
+					for (int l=0; l < b.runs; l++)
+						res.ok &= run_once(&b, type[t], storage[s], replay[r], size, input,
+							&walls[l], &waits[l], &res.out);
+					qsort(walls, (size_t) b.runs, sizeof(double), &double_cmp);
+					qsort(waits, (size_t) b.runs, sizeof(double), &double_cmp);
+					res.wall = walls[b.runs / 2];
+					res.to_editor = waits[b.runs / 2];
+					report(&b, size, type[t], storage[s], replay[r], &res);
+				}
+		}
+		unlink(input);
+		if (size == max) break;
+	}
+	if (b.json) printf("]\n");
+
+	free(walls);
+	free(waits);
+	free(types);
+	free(storages);
+	free(replays);
+	return 0;
+}
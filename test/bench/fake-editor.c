@@ -0,0 +1,141 @@
+// A deterministic stand-in for a person at an editor, for benchmarks.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <time.h>
+#include <regex.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+
+
+/* NOTE:
+ *  Usage: m-vipe-fake-editor TRANSFORM FILE...
+ *
+ *  TRANSFORM is applied to every FILE in place:
+ *    noop              leave it alone
+ *    append=TEXT       add TEXT to the end
+ *    replace=RE=TEXT   replace every match of the extended regex RE, line by
+ *                      line, like `sed -E 's/RE/TEXT/g'`
+ *    truncate=N        cut it down to N bytes
+ *
+ *  When MVIPE_BENCH_STAMP names a file, the CLOCK_MONOTONIC time this
+ *  process started at is written there first, in nanoseconds, so a driver
+ *  can tell how long it took m-vipe to hand over.
+ */
+
+static void stamp(void) {
+	const char *path = getenv("MVIPE_BENCH_STAMP");
+	struct timespec now;
+	if (path == NULL) return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	FILE *out = fopen(path, "w");
+	if (out == NULL) error(1, errno, "Couldn't open '%s'", path);
+	fprintf(out, "%lld\n", (long long) now.tv_sec * 1000000000LL + now.tv_nsec);
+	if (fclose(out) != 0) error(1, errno, "Couldn't write '%s'", path);
+}
+
+/**
+ * @description - Rewrites path line by line through `re`, via a temporary
+ *   file, then copies the result back over the original. The original has
+ *   to be written in place; m-vipe hands out /proc/self/fd paths.
+ */
+static void replace(const char *path, const regex_t *re, const char *text) {
+	FILE *in = fopen(path, "r+");
+	FILE *tmp = tmpfile();
+	char *line = NULL;
+	size_t cap = 0, textlen = strlen(text);
+	ssize_t len;
+	regmatch_t match;
+
+	if (in == NULL || tmp == NULL) error(1, errno, "Couldn't open '%s'", path);
+	while ((len = getline(&line, &cap, in)) > 0) {
+		// REG_STARTEND lets lines hold NULs, and gives the end of the line.
+		const char *at = line, *end = line + len;
+		while (at < end) {
+			match.rm_so = 0;
+			match.rm_eo = end - at;
+			if (regexec(re, at, 1, &match, REG_STARTEND | (at != line ? REG_NOTBOL : 0)) != 0)
+				break;
+			fwrite(at, 1, (size_t) match.rm_so, tmp);
+			fwrite(text, 1, textlen, tmp);
+			// An empty match still has to move on.
+			if (match.rm_eo == match.rm_so) {
+				if (at + match.rm_eo < end) fputc(at[match.rm_eo], tmp);
+				match.rm_eo++;
+			}
+			at += match.rm_eo;
+		}
+		if (at < end) fwrite(at, 1, (size_t) (end - at), tmp);
+	}
+	free(line);
+
+	rewind(tmp);
+	rewind(in);
+	char buf[1 << 16];
+	size_t n;
+	off_t size = 0;
+	while ((n = fread(buf, 1, sizeof(buf), tmp)) != 0) {
+		if (fwrite(buf, 1, n, in) != n) error(1, errno, "Couldn't write '%s'", path);
+		size += (off_t) n;
+	}
+	if (fflush(in) != 0 || ftruncate(fileno(in), size) != 0)
+		error(1, errno, "Couldn't write '%s'", path);
+	fclose(tmp);
+	fclose(in);
+}
+
+int main(int argc, char **argv) {
+	stamp();
+	if (argc < 2) error(2, 0, "Usage: %s TRANSFORM FILE...", argv[0]);
+
+	const char *transform = argv[1];
+	regex_t re;
+	char *text = NULL;
+	if (strncmp(transform, "replace=", 8) == 0) {
+		char *pattern = xstrdup(transform + 8);
+		text = strchr(pattern, '=');
+		if (text == NULL) error(2, 0, "replace needs RE=TEXT");
+		*text++ = '\0';
+		int err = regcomp(&re, pattern, REG_EXTENDED);
+		if (err != 0) {
+			char why[256];
+			regerror(err, &re, why, sizeof(why));
+			error(2, 0, "Bad regex '%s': %s", pattern, why);
+		}
+	}
+	else if (strcmp(transform, "noop") != 0 && strncmp(transform, "append=", 7) != 0
+			&& strncmp(transform, "truncate=", 9) != 0)
+		error(2, 0, "Unknown transform '%s'", transform);
+
+	for (int l=2; l < argc; l++) {
+		const char *path = argv[l];
+		if (strncmp(transform, "append=", 7) == 0) {
+			const char *add = transform + 7;
+			int fd = open(path, O_WRONLY | O_APPEND);
+			if (fd < 0 || full_write(fd, add, strlen(add)) != strlen(add) || close(fd) != 0)
+				error(1, errno, "Couldn't append to '%s'", path);
+		}
+		else if (strncmp(transform, "truncate=", 9) == 0) {
+			if (truncate(path, (off_t) strtoll(transform + 9, NULL, 10)) != 0)
+				error(1, errno, "Couldn't truncate '%s'", path);
+		}
+		else if (text != NULL)
+			replace(path, &re, text);
+	}
+	return 0;
+}
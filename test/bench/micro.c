@@ -0,0 +1,277 @@
+// Microbenchmarks for editor resolution and argv construction.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <time.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <gnulib/xalloc.h>
+#include <argparse.h>
+
+// Internal Includes
+#include <internal.h>
+
+
+/* NOTE:
+ *  Times the helpers every invocation runs before the editor can start:
+ *  PATH search with shpaccvar and shexpaccvar, the whole sensible-editor,
+ *  VISUAL, EDITOR, nano, vi fallback chain, argv growth with pushvar and
+ *  ccvar up to ARG_MAX, and BINALLOC on its own.
+ *
+ *  PATHs of 10 to 500 directories are built under TMPDIR, with the command
+ *  only in the last one, which is the worst case and the common one for
+ *  `vi`. The slow variants stand in for FUSE or NFS mounts: this binary is
+ *  linked with `--wrap=access`, so every access() on them sleeps first.
+ *  Each case repeats until it has run for --budget milliseconds.
+ */
+
+static const char *const usage[] = {
+	"m-vipe-microbench [--delay-us=N] [--budget=MS] [--format=csv|json] [--label=STR]",
+	NULL,
+};
+
+static const size_t path_sizes[] = { 10, 50, 100, 500 };
+#define NSIZES (sizeof(path_sizes) / sizeof(size_t))
+
+static char slow_prefix[4096];
+static size_t slow_len;
+static struct timespec slow_delay;
+
+int __real_access(const char *path, int mode);
+
+int __wrap_access(const char *path, int mode) {
+	if (slow_len != 0 && strncmp(path, slow_prefix, slow_len) == 0)
+		nanosleep(&slow_delay, NULL);
+	return __real_access(path, mode);
+}
+
+struct micro {
+	const char *label;
+	bool json;
+	double budget; // Seconds per case.
+	size_t rows;
+};
+
+struct resolve_case {
+	const char *command; // What to resolve.
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * @description - Runs op in doubling batches until the budget is spent.
+ * @return - nanoseconds per call.
+ */
+static double measure(const struct micro *m, void (*op)(void *), void *ctx, size_t *ops) {
+	double took = 0;
+	size_t total = 0;
+	for (size_t batch = 1; took < m->budget; batch *= 2) {
+		double t0 = now();
+		for (size_t l=0; l < batch; l++) op(ctx);
+		took += now() - t0;
+		total += batch;
+	}
+	*ops = total;
+	return took / (double) total * 1e9;
+}
+
+static void report(struct micro *m, const char *bench, const char *variant, size_t ops, double ns) {
+	if (m->json)
+		printf("%s{\"label\":\"%s\",\"bench\":\"%s\",\"case\":\"%s\",\"ops\":%zu,\"ns_per_op\":%.1f}",
+			m->rows != 0 ? ",\n " : "", m->label, bench, variant, ops, ns);
+	else {
+		if (m->rows == 0) printf("label,bench,case,ops,ns_per_op\n");
+		printf("%s,%s,%s,%zu,%.1f\n", m->label, bench, variant, ops, ns);
+	}
+	fflush(stdout);
+	m->rows++;
+}
+
+static void op_shpaccvar(void *arg) {
+	struct resolve_case *rc = arg;
+	char *str = xstrdup(rc->command), **argv = NULL;
+	size_t argc = 0;
+	if (shpaccvar(&str, &argv, &argc) != true) error(1, errno, "Couldn't resolve %s", rc->command);
+	free(str);
+	free(argv);
+}
+
+static void op_shexpaccvar(void *arg) {
+	struct resolve_case *rc = arg;
+	char *str = xstrdup(rc->command), **argv = NULL;
+	size_t argc = 0;
+	if (shexpaccvar(&str, &argv, &argc) != true) error(1, errno, "Couldn't resolve %s", rc->command);
+	free(str);
+	free(argv);
+}
+
+// Everything `m-vipe` with no EDITOR does before it can spawn.
+static void op_chain(void *arg) {
+	struct editor_launch el = { .filter = true };
+	(void) arg;
+	resolve_forget();
+	posix_spawn_file_actions_init(&el.fact);
+	resolve_editor(&el);
+	if (el.status != 0) error(1, el.error, "%s", el.message);
+	release_editor(&el);
+}
+
+static size_t arg_max;
+
+static void op_pushvar(void *arg) {
+	char *word = "x", **argv = NULL;
+	size_t argc = 0;
+	(void) arg;
+	while (argc < arg_max)
+		if (pushvar(&word, &argv, &argc) != true) error(1, errno, "pushvar");
+	free(argv);
+}
+
+static void op_ccvar(void *arg) {
+	char **block = arg, **argv = NULL;
+	size_t argc = 0;
+	while (argc < arg_max)
+		if (ccvar(&argv, &argc, block, 64) != true) error(1, errno, "ccvar");
+	free(argv);
+}
+
+static volatile size_t binalloc_sink;
+
+static void op_binalloc(void *arg) {
+	size_t sum = 0;
+	(void) arg;
+	for (size_t n=1; n <= 1024; n++) sum += BINALLOC(sizeof(void*), n);
+	binalloc_sink = sum;
+}
+
+/**
+ * @description - Makes count-1 empty directories and one holding an
+ *   executable `name`, under base.
+ * @return - the PATH searching them, with the command last.
+ */
+static char *make_path(const char *base, size_t count, const char *name) {
+	size_t cap = (strlen(base) + 16) * count + 1;
+	char *path = xmalloc(cap), dir[4096];
+	*path = '\0';
+
+	mkdir(base, 0700);
+	for (size_t l=0; l + 1 < count; l++) {
+		snprintf(dir, sizeof(dir), "%s/d%zu", base, l);
+		mkdir(dir, 0700);
+		strcat(path, dir);
+		strcat(path, ":");
+	}
+	snprintf(dir, sizeof(dir), "%s/t%zu", base, count);
+	mkdir(dir, 0700);
+	strcat(path, dir);
+	// access() only looks at the mode bits; an empty file does.
+	snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/%s", name);
+	int fd = open(dir, O_WRONLY | O_CREAT | O_CLOEXEC, 0755);
+	if (fd < 0) error(1, errno, "Couldn't create '%s'", dir);
+	close(fd);
+	return path;
+}
+
+static void remove_tree(const char *base) {
+	char cmd[8192];
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", base);
+	if (system(cmd) != 0) error(0, 0, "Couldn't remove '%s'", base);
+}
+
+int main(int argc, const char **argv) {
+	struct micro m = { .label = "" };
+	int delay_us = 100, budget_ms = 200;
+	const char *format = "csv";
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_INTEGER('\0', "delay-us", &delay_us,
+			"How long each access() on a slow directory takes (default 100).", NULL, 0, 0),
+		OPT_INTEGER('\0', "budget", &budget_ms,
+			"Milliseconds to spend on each case (default 200).", NULL, 0, 0),
+		OPT_STRING('\0', "format", &format, "csv (the default) or json.", NULL, 0, 0),
+		OPT_STRING('\0', "label", &m.label,
+			"Put in every row, to tell commits apart when comparing.", NULL, 0, 0),
+		OPT_END(),
+	};
+	struct argparse argparse;
+	argparse_init(&argparse, options, usage, 0);
+	argparse_parse(&argparse, argc, argv);
+	if (strcmp(format, "json") != 0 && strcmp(format, "csv") != 0)
+		error(2, 0, "Unknown format '%s'", format);
+	m.json = strcmp(format, "json") == 0;
+	m.budget = budget_ms / 1e3;
+	slow_delay.tv_sec = delay_us / 1000000;
+	slow_delay.tv_nsec = (long) (delay_us % 1000000) * 1000;
+
+	const char *tmp = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+	char root[4000], base[4096], variant[64];
+	snprintf(root, sizeof(root), "%s/m-vipe-micro-XXXXXX", tmp);
+	if (mkdtemp(root) == NULL) error(1, errno, "Couldn't create '%s'", root);
+	snprintf(slow_prefix, sizeof(slow_prefix), "%s/slow/", root);
+	char *saved_path = getenv("PATH") != NULL ? xstrdup(getenv("PATH")) : NULL;
+	// The chain tries four others first; none of them may be found.
+	unsetenv("VISUAL");
+	unsetenv("EDITOR");
+
+	if (m.json) printf("[");
+	for (int slow=0; slow < 2; slow++)
+		for (size_t s=0; s < NSIZES; s++) {
+			size_t ops;
+			double ns;
+			snprintf(base, sizeof(base), "%s/%s", root, slow ? "slow" : "local");
+			char *path = make_path(base, path_sizes[s], "vi");
+			setenv("PATH", path, 1);
+			slow_len = slow ? strlen(slow_prefix) : 0;
+			snprintf(variant, sizeof(variant), "%zu %s dirs", path_sizes[s], slow ? "slow" : "local");
+
+			struct resolve_case rc = { .command = "vi" };
+			ns = measure(&m, &op_shpaccvar, &rc, &ops);
+			report(&m, "shpaccvar", variant, ops, ns);
+			rc.command = "vi -u NONE --noplugin";
+			ns = measure(&m, &op_shexpaccvar, &rc, &ops);
+			report(&m, "shexpaccvar", variant, ops, ns);
+			ns = measure(&m, &op_chain, NULL, &ops);
+			report(&m, "fallback chain", variant, ops, ns);
+
+			slow_len = 0;
+			free(path);
+		}
+	if (saved_path != NULL) setenv("PATH", saved_path, 1);
+	free(saved_path);
+	resolve_forget();
+
+	long max = sysconf(_SC_ARG_MAX);
+	arg_max = (size_t) (max > 0 ? max : 1 << 21) / sizeof(char*);
+	char *block[64];
+	for (size_t l=0; l < 64; l++) block[l] = "x";
+	size_t ops;
+	double ns;
+	snprintf(variant, sizeof(variant), "0 to %zu args", arg_max);
+	ns = measure(&m, &op_pushvar, NULL, &ops);
+	report(&m, "pushvar", variant, ops, ns);
+	snprintf(variant, sizeof(variant), "0 to %zu args by 64", arg_max);
+	ns = measure(&m, &op_ccvar, block, &ops);
+	report(&m, "ccvar", variant, ops, ns);
+	ns = measure(&m, &op_binalloc, NULL, &ops);
+	report(&m, "BINALLOC", "counts 1 to 1024", ops, ns);
+	if (m.json) printf("]\n");
+
+	remove_tree(root);
+	return 0;
+}
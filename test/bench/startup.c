@@ -0,0 +1,199 @@
+// Cold start benchmark: how long m-vipe takes from exec to the editor's exec
+// for tiny inputs, checked against a budget.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <time.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <gnulib/full-write.h>
+#include <gnulib/xalloc.h>
+#include <argparse.h>
+
+
+/* NOTE:
+ *  With a few bytes of input nearly all of m-vipe's latency is startup:
+ *  the loader, argument parsing, setting up the session and finding the
+ *  editor. This times exactly that, from the moment the child calls execv
+ *  until m-vipe-fake-editor's main(), so fork and pty setup don't count but
+ *  the editor's own loading does; that part is the same for every build.
+ *
+ *  Input is --size bytes in a pipe, already written and closed, and output
+ *  goes to /dev/null. Every run has a fresh session on one pty, like
+ *  m-vipe-bench. After --warmup untimed runs the percentiles of --runs are
+ *  reported. With --budget-us, the exit status is 1 when the median is
+ *  over it, so CI can run this against a Release build, or two builds with
+ *  --bin to compare MVIPE_STATIC with the default.
+ */
+
+static const char *const usage[] = {
+	"m-vipe-startup-bench [--runs=N] [--size=BYTES] [--budget-us=N] [options]",
+	NULL,
+};
+
+struct startup {
+	const char *bin;
+	const char *editor;
+	const char *slave;
+	const char *stamp;
+	long long *exec_at; // Shared with the child, set just before execv.
+	char *input;
+	int size;
+};
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int ll_cmp(const void *a, const void *b) {
+	long long x = *(const long long *) a, y = *(const long long *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @description - Runs m-vipe once over the input.
+ * @return - nanoseconds from execv to the editor starting, or -1 when the
+ *   run failed.
+ */
+static long long run(const struct startup *st) {
+	int in[2];
+	if (pipe2(in, O_CLOEXEC) != 0) error(1, errno, "Couldn't create a pipe");
+	// At most a page, so it all fits in the pipe before anyone reads it.
+	if (full_write(in[1], st->input, (size_t) st->size) != (size_t) st->size)
+		error(1, errno, "Couldn't fill the pipe");
+	close(in[1]);
+	unlink(st->stamp);
+
+	const char *argv[] = { st->bin, "--", st->editor, "noop", NULL };
+	pid_t pid = fork();
+	if (pid < 0) error(1, errno, "Couldn't fork");
+	if (pid == 0) {
+		setsid();
+		int tty = open(st->slave, O_RDWR);
+		int out = open("/dev/null", O_WRONLY);
+		if (tty < 0 || out < 0 || dup2(in[0], 0) < 0 || dup2(out, 1) < 0) _exit(126);
+		*st->exec_at = now_ns();
+		execv(st->bin, (char **) argv);
+		_exit(127);
+	}
+	close(in[0]);
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+	long long ns = 0;
+	FILE *sf = fopen(st->stamp, "r");
+	bool stamped = sf != NULL && fscanf(sf, "%lld", &ns) == 1;
+	if (sf != NULL) fclose(sf);
+	if (stamped != true || WIFEXITED(status) != true || WEXITSTATUS(status) != 0) return -1;
+	return ns - *st->exec_at;
+}
+
+int main(int argc, const char **argv) {
+	struct startup st = {
+		.bin = MVIPE_BENCH_BIN,
+		.editor = MVIPE_BENCH_EDITOR,
+		.size = 64,
+	};
+	int runs = 200, warmup = 10, budget_us = 0;
+	const char *format = "csv", *label = "";
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_STRING('\0', "bin", &st.bin, "m-vipe to run (default: the one built with this).",
+			NULL, 0, 0),
+		OPT_STRING('\0', "editor", &st.editor, "Editor to run (default: m-vipe-fake-editor).",
+			NULL, 0, 0),
+		OPT_INTEGER('\0', "runs", &runs, "Timed runs (default 200).", NULL, 0, 0),
+		OPT_INTEGER('\0', "warmup", &warmup, "Untimed runs first (default 10).", NULL, 0, 0),
+		OPT_INTEGER('\0', "size", &st.size, "Bytes of input, up to 4096 (default 64).",
+			NULL, 0, 0),
+		OPT_INTEGER('\0', "budget-us", &budget_us,
+			"Exit with 1 when the median is over this many microseconds.", NULL, 0, 0),
+		OPT_STRING('\0', "format", &format, "csv (the default) or json.", NULL, 0, 0),
+		OPT_STRING('\0', "label", &label,
+			"Put in the row, to tell builds apart when comparing.", NULL, 0, 0),
+		OPT_END(),
+	};
+	struct argparse argparse;
+	argparse_init(&argparse, options, usage, 0);
+	argparse_parse(&argparse, argc, argv);
+	if (strcmp(format, "json") != 0 && strcmp(format, "csv") != 0)
+		error(2, 0, "Unknown format '%s'", format);
+	if (runs < 1 || warmup < 0 || st.size < 0 || st.size > 4096 || budget_us < 0)
+		error(2, 0, "Bad --runs, --warmup, --size or --budget-us");
+
+	st.input = xmalloc((size_t) st.size + 1);
+	for (int l=0; l < st.size; l++) st.input[l] = l % 64 == 63 ? '\n' : 'a' + l % 26;
+	st.exec_at = mmap(NULL, sizeof(long long), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (st.exec_at == MAP_FAILED) error(1, errno, "Couldn't map a shared page");
+
+	const char *tmp = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+	char stamp[4096];
+	snprintf(stamp, sizeof(stamp), "%s/m-vipe-startup-XXXXXX", tmp);
+	int stampfd = mkstemp(stamp);
+	if (stampfd < 0) error(1, errno, "Couldn't create '%s'", stamp);
+	close(stampfd);
+	st.stamp = stamp;
+	setenv("MVIPE_BENCH_STAMP", stamp, 1);
+	unsetenv("VISUAL");
+	unsetenv("EDITOR");
+
+	int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+		error(1, errno, "Couldn't open a pty");
+	st.slave = xstrdup(ptsname(master));
+	struct termios tio;
+	int pts = open(st.slave, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (pts < 0 || tcgetattr(pts, &tio) != 0) error(1, errno, "Couldn't set up '%s'", st.slave);
+	tio.c_lflag &= ~(tcflag_t) ECHO;
+	tcsetattr(pts, TCSANOW, &tio);
+	close(pts);
+
+	long long *took = xmalloc((size_t) runs * sizeof(long long));
+	for (int l=0; l < warmup; l++)
+		if (run(&st) < 0) error(1, 0, "%s failed during warmup", st.bin);
+	for (int l=0; l < runs; l++)
+		if ((took[l] = run(&st)) < 0) error(1, 0, "%s failed on run %d", st.bin, l + 1);
+	unlink(stamp);
+	close(master);
+
+	qsort(took, (size_t) runs, sizeof(long long), &ll_cmp);
+	#define PCT(p) ((double) took[(size_t) (runs - 1) * (p) / 100] / 1e3)
+	double median = PCT(50);
+	bool over = budget_us != 0 && median > budget_us;
+	if (strcmp(format, "json") == 0)
+		printf("{\"label\":\"%s\",\"size\":%d,\"runs\":%d,\"min_us\":%.1f,\"p50_us\":%.1f,"
+			"\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"budget_us\":%d,\"ok\":%s}\n",
+			label, st.size, runs, PCT(0), median, PCT(90), PCT(99), PCT(100), budget_us,
+			over ? "false" : "true");
+	else
+		printf("label,size,runs,min_us,p50_us,p90_us,p99_us,max_us,budget_us,ok\n"
+			"%s,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%d,%s\n", label, st.size, runs, PCT(0), median,
+			PCT(90), PCT(99), PCT(100), budget_us, over ? "false" : "true");
+	#undef PCT
+	if (over) error(0, 0, "Median exec to editor of %.1fus is over the %dus budget",
+		median, budget_us);
+
+	free(took);
+	free(st.input);
+	free((char *) st.slave);
+	return over ? 1 : 0;
+}
@@ -0,0 +1,21 @@
+// Runs every test suite; see `m-vipe-test --help` for picking some out.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// External Includes
+#include <munit.h>
+
+// Internal Includes
+#include "test.h"
+
+
+int main(int argc, char *argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+	const MunitSuite suites[] = {
+		backends_suite,
+		parallel_suite,
+		{ NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE },
+	};
+	const MunitSuite all = { "", NULL, (MunitSuite *) suites, 1, MUNIT_SUITE_OPTION_NONE };
+	return munit_suite_main(&all, NULL, argc, argv);
+}
@@ -0,0 +1,96 @@
+// `--parallel` with filters that edit their file in place.
+
+// Special Include (Necessary for working with gnulib)
+#include <config.h>
+
+// Standard Includes
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// External Includes
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <munit.h>
+#include <gnulib/xalloc.h>
+
+// Internal Includes
+#include <mvipe.h>
+#include "test.h"
+
+
+/* NOTE:
+ *  `sed -i` writes a copy beside the file it's given and renames it over,
+ *  so every shard has to be a real file in a directory, and reassembly has
+ *  to read what's at the path afterwards, not the descriptor it started
+ *  with. The input is numbered lines so a shard out of place or lost shows.
+ */
+
+#define LINES 20000
+
+/**
+ * @description - Makes an unlinked temporary file holding size bytes of data.
+ * @return - its descriptor, rewound.
+ */
+static int temp_file(const char *data, size_t size) {
+	char path[] = "/tmp/m-vipe-test-XXXXXX";
+	int fd = mkostemp(path, O_CLOEXEC);
+	munit_assert_int(fd, >=, 0);
+	unlink(path);
+	munit_assert_size((size_t) write(fd, data, size), ==, size);
+	munit_assert_int(lseek(fd, 0, SEEK_SET), ==, 0);
+	return fd;
+}
+
+static MunitResult test_in_place(const MunitParameter params[], void *data) {
+	const char *editor[] = { "sed", "-i", "s/^a/X/", NULL };
+	struct mvipe_options opts = {
+		.argc = 3, .argv = editor,
+		.parallel = (unsigned) strtoul(munit_parameters_get(params, "shards"), NULL, 10),
+		.volat = strcmp(munit_parameters_get(params, "storage"), "memfd") == 0,
+	};
+	size_t cap = LINES * 16, size = 0, wsize = 0;
+	char *input = xmalloc(cap), *want = xmalloc(cap);
+	(void) data;
+
+	for (int l=0; l < LINES; l++) {
+		size += (size_t) sprintf(input + size, "a%d\n", l);
+		wsize += (size_t) sprintf(want + wsize, "X%d\n", l);
+	}
+	opts.tty = open("/dev/null", O_RDWR | O_CLOEXEC);
+	int in = temp_file(input, size), out = temp_file("", 0);
+
+	munit_assert_int(mvipe_run(&opts, in, out), ==, 0);
+	struct stat stat_buf;
+	munit_assert_int(fstat(out, &stat_buf), ==, 0);
+	munit_assert_size((size_t) stat_buf.st_size, ==, wsize);
+	char *got = xmalloc(wsize + 1);
+	munit_assert_size((size_t) pread(out, got, wsize, 0), ==, wsize);
+	munit_assert_memory_equal(wsize, got, want);
+
+	free(got);
+	free(input);
+	free(want);
+	close(in);
+	close(out);
+	close(opts.tty);
+	return MUNIT_OK;
+}
+
+static char *shards[] = { "2", "4", "16", NULL };
+static char *storages[] = { "file", "memfd", NULL };
+
+static MunitParameterEnum params[] = {
+	{ "shards", shards },
+	{ "storage", storages },
+	{ NULL, NULL },
+};
+
+static MunitTest tests[] = {
+	{ "/in-place", &test_in_place, NULL, NULL, MUNIT_TEST_OPTION_NONE, params },
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
+};
+
+const MunitSuite parallel_suite = { "/parallel", tests, NULL, 1, MUNIT_SUITE_OPTION_NONE };
@@ -0,0 +1,14 @@
+// Suites making up m-vipe-test, see main.c.
+#ifndef MVIPE_TEST_H
+#define MVIPE_TEST_H
+
+// External Includes
+#include <munit.h>
+
+// Every capture and replay backend against the reference copy loop.
+extern const MunitSuite backends_suite;
+
+// `--parallel` shards under filters that rename over their file.
+extern const MunitSuite parallel_suite;
+
+#endif /* MVIPE_TEST_H */
@@ -85,10 +85,16 @@ update_gnulib_modules()
 		# TODO: remove msvc or make their addition to the library conditional
 		#       for now, best option is to filter because Windows doesn't support
 		#       a lot of the library functions I'm using.
+		# NOTE: open.c and raise.c define the unprefixed libc symbols and call
+		#       through to themselves when the platform doesn't need replacing,
+		#       which recurses until the stack runs out. configure already
+		#       decided glibc's are fine, so never link them.
 		SOURCES=$(ls -f1 lib/*.c | {
 			while read line; do
 				test "$line" != "${line#lib/msvc}" || \
 				test "$line" != "${line#lib/windows}" || \
+				test "$line" = "lib/open.c" || \
+				test "$line" = "lib/raise.c" || \
 				echo "$line";
 			done;
 		});